@@ -0,0 +1,57 @@
+#include "boids_core.h"
+#include "modeling_model.h"
+#include "modeling_airfoil.h"
+#include <string.h>
+
+
+/* collision and lofting memory of the single model driven through the core */
+static CollisionContext *collision_context = 0;
+static LoftContext *loft_context = 0;
+static LoftSettings settings;
+
+/* Initializes everything lofting and collision depend on. Has to be called once before
+anything else. */
+void boids_core_init() {
+    airfoil_init_base();
+    collision_context = model_make_collision_context();
+    loft_context = model_make_loft_context();
+    settings = config_default_loft_settings();
+}
+
+/* Settings used for collision and lofting, can be changed between calls. */
+LoftSettings *boids_core_settings() {
+    return &settings;
+}
+
+/* Replaces model contents with the model dump found at path. */
+void boids_core_load(Model *model, const char *path) {
+    model_serial_load(model, path);
+}
+
+/* Steps element collision, returns true if some elements moved and model has to be relofted. */
+bool boids_core_collide(Model *model, bool dragging) {
+    return model_collision_run(collision_context, model, &settings, dragging);
+}
+
+/* Lofts model skin and returns resulting vertices and panels. */
+void boids_core_loft(Model *model, BoidsMesh *mesh, LoftReport *report) {
+    if (model->objects_count == 0) { /* nothing to loft, don't leave the previous skin in model */
+        model->skin_verts = 0;
+        model->skin_verts_count = 0;
+        model->panels = 0;
+        model->panels_count = 0;
+        mesh->verts = 0;
+        mesh->verts_count = 0;
+        mesh->panels = 0;
+        mesh->panels_count = 0;
+        if (report)
+            memset(report, 0, sizeof(LoftReport));
+        return;
+    }
+
+    model_loft(loft_context, model, &settings, report);
+    mesh->verts = model->skin_verts;
+    mesh->verts_count = model->skin_verts_count;
+    mesh->panels = model->panels;
+    mesh->panels_count = model->panels_count;
+}
@@ -0,0 +1,30 @@
+#ifndef boids_core_h
+#define boids_core_h
+
+/* Headless entry point into the lofter. Only depends on the core units (modeling_*,
+math_*, memory_arena, serial, util_* and platform), so it can be used without a window
+or a GL context. */
+
+
+struct vec3;
+struct Model;
+struct Panel;
+struct LoftSettings;
+struct LoftReport;
+
+/* Skin mesh produced by lofting. Points into core owned memory and is only valid
+until the next call to boids_core_loft(). */
+struct BoidsMesh {
+    vec3 *verts;
+    int verts_count;
+    Panel *panels;
+    int panels_count;
+};
+
+void boids_core_init();
+LoftSettings *boids_core_settings();
+void boids_core_load(Model *model, const char *path);
+bool boids_core_collide(Model *model, bool dragging);
+void boids_core_loft(Model *model, BoidsMesh *mesh, LoftReport *report=0);
+
+#endif
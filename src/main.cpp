@@ -5,12 +5,12 @@
 #include "ui_pick.h"
 #include "ui_drag.h"
 #include "ui_warehouse.h"
+#include "boids_core.h"
 #include "modeling_object.h"
 #include "modeling_shape.h"
 #include "modeling_ochre.h"
 #include "modeling_airfoil.h"
 #include "modeling_config.h"
-#include "memory_arena.h"
 #include "math_vec.h"
 #include "math_mat.h"
 #include "proc_apame.h"
@@ -33,12 +33,10 @@ PickResult pick_result;
 
 vec3 crosshair_verts[4];
 
-/* arena used for collision and lofting */
-static Arena arena(20000000);
-
 
 void _recalculate_model() {
-    model_loft(&arena, &ui_model.model);
+    BoidsMesh mesh;
+    boids_core_loft(&ui_model.model, &mesh);
     ui_model_update_mantles(&ui_model);
     SkinVertColorSource source = NO_SOURCE;
 #ifdef BOIDS_USE_APAME
@@ -111,19 +109,19 @@ void _key_callback(int key, int mods, int action) {
                 }
             }
             else if (key == WINDOW_KEY_O) {
-                config_decrease_shape_samples();
+                config_decrease_shape_samples(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_P) {
-                config_increase_shape_samples();
+                config_increase_shape_samples(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_K) {
-                config_decrease_structural_margin();
+                config_decrease_structural_margin(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_L) {
-                config_increase_structural_margin();
+                config_increase_structural_margin(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_N) {
@@ -133,19 +131,23 @@ void _key_callback(int key, int mods, int action) {
                 config_increase_mesh_triangle_edge_transparency();
             }
             else if (key == WINDOW_KEY_B) {
-                mesh_verts_merge_margin(true);
+                config_increase_collapse_margin(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_V) {
-                mesh_verts_merge_margin(false);
+                config_decrease_collapse_margin(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_H) {
-                config_decrease_merge_interpolation_delay();
+                config_decrease_merge_interpolation_delay(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_J) {
-                config_increase_merge_interpolation_delay();
+                config_increase_merge_interpolation_delay(boids_core_settings());
+                _recalculate_model();
+            }
+            else if (key == WINDOW_KEY_T) {
+                config_toggle_exact_tracing(boids_core_settings());
                 _recalculate_model();
             }
             else if (key == WINDOW_KEY_R) {
@@ -193,7 +195,7 @@ void _main_loop_func() {
 
     /* step colliders */
 
-    if (model_collision_run(&ui_model.model, &arena, drag.dragging))
+    if (boids_core_collide(&ui_model.model, drag.dragging))
         reloft = true;
 
     /* reloft fuselages */
@@ -282,11 +284,10 @@ int main() {
     airfoil_generate_base();
     return 0;
 #else
-    airfoil_init_base();
+    boids_core_init();
 #endif
 
     warehouse_init();
-    model_collision_init();
 
     /* create window */
 
@@ -0,0 +1,116 @@
+#include "boids_core.h"
+#include "modeling_model.h"
+#include "modeling_config.h"
+#include "platform.h"
+#include "memory_arena.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Batch lofter. Lofts model dumps written by model_serial_dump() and writes resulting meshes
+with model_serial_dump_mesh_binary(). Usage:
+
+    boids-batch [-exact] <dumps_dir> [out_dir]
+    boids-batch [-exact] - [out_dir] < dump_paths.txt
+
+Everything lofting needs (airfoils, arenas, model) is set up once and reused for all dumps.
+With -exact envelopes are traced with exact predicates, otherwise the summary reports how
+often tracing had to be retried. */
+
+#define _MAX_PATH_LENGTH 1024
+
+
+struct _Batch {
+    Model model;
+    const char *out_dir;
+    int models_count;
+    int verts_count;
+    int panels_count;
+    TraceStats traces;
+};
+
+/* Mesh path is dump path with .dump extension replaced by .mesh, optionally moved to out_dir. */
+static void _mesh_path(const char *dump_path, const char *out_dir, char *mesh_path) {
+    const char *name = dump_path;
+    if (out_dir) { /* strip directory */
+        for (const char *c = dump_path; *c; ++c)
+            if (*c == '/' || *c == '\\')
+                name = c + 1;
+        snprintf(mesh_path, _MAX_PATH_LENGTH, "%s/%s", out_dir, name);
+    }
+    else
+        snprintf(mesh_path, _MAX_PATH_LENGTH, "%s", dump_path);
+
+    int length = (int)strlen(mesh_path);
+    if (length > 5 && strcmp(mesh_path + length - 5, ".dump") == 0)
+        mesh_path[length - 5] = '\0';
+    strncat(mesh_path, ".mesh", _MAX_PATH_LENGTH - strlen(mesh_path) - 1);
+}
+
+static void _loft_dump(const char *path, void *data) {
+    _Batch *batch = (_Batch *)data;
+
+    int length = (int)strlen(path);
+    if (length < 5 || strcmp(path + length - 5, ".dump") != 0) /* skip everything that's not a model dump */
+        return;
+
+    boids_core_load(&batch->model, path);
+
+    BoidsMesh mesh;
+    LoftReport report;
+    boids_core_loft(&batch->model, &mesh, &report);
+
+    char mesh_path[_MAX_PATH_LENGTH];
+    _mesh_path(path, batch->out_dir, mesh_path);
+    model_serial_dump_mesh_binary(&batch->model, mesh_path);
+
+    ++batch->models_count;
+    batch->verts_count += mesh.verts_count;
+    batch->panels_count += mesh.panels_count;
+    batch->traces.traced += report.traces.traced;
+    batch->traces.retried += report.traces.retried;
+    batch->traces.retries += report.traces.retries;
+    batch->traces.failed += report.traces.failed;
+}
+
+int main(int argc, char **argv) {
+    bool exact = argc > 1 && strcmp(argv[1], "-exact") == 0;
+    if (exact) { /* skip option */
+        --argc;
+        ++argv;
+    }
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: boids-batch [-exact] <dumps_dir | -> [out_dir]\n");
+        return 1;
+    }
+
+    boids_core_init();
+    boids_core_settings()->exact_tracing = exact;
+
+    static _Batch batch;
+    batch.out_dir = (argc > 2) ? argv[2] : 0;
+    batch.models_count = 0;
+    batch.verts_count = 0;
+    batch.panels_count = 0;
+    memset(&batch.traces, 0, sizeof(batch.traces));
+
+    if (strcmp(argv[1], "-") == 0) { /* dump paths from stdin, one per line */
+        char path[_MAX_PATH_LENGTH];
+        while (fgets(path, _MAX_PATH_LENGTH, stdin)) {
+            path[strcspn(path, "\r\n")] = '\0';
+            if (path[0] != '\0')
+                _loft_dump(path, &batch);
+        }
+    }
+    else if (!platform_list_dir(argv[1], _loft_dump, &batch)) {
+        fprintf(stderr, "cannot open directory %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(stderr, "lofted %d models, %d vertices, %d panels\n", batch.models_count, batch.verts_count, batch.panels_count);
+    fprintf(stderr, "traced %d envelopes, %d retried %d times, %d failed\n",
+            batch.traces.traced, batch.traces.retried, batch.traces.retries, batch.traces.failed);
+    arena_report(stderr);
+
+    return 0;
+}
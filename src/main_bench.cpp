@@ -0,0 +1,111 @@
+#include "boids_core.h"
+#include "modeling_model.h"
+#include "modeling_object.h"
+#include "modeling_collision.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+
+/* Collision kernel benchmark. Records prism pairs that overlap along x in a model dump written
+by model_serial_dump(), with objects where they were dumped, and times coll_interact_prisms
+against its scalar version on them. Also reports the largest difference between their forces,
+which should be 0. Usage:
+
+    boids-bench <dump> [repeats]
+*/
+
+
+typedef bool (*_INTERACT_FUNC)(CollPrism *prism1, CollPrism *prism2, double dx, double dy, double dz, double *f);
+
+struct _Pair {
+    CollPrism *prism1, *prism2;
+    double dx, dy, dz;
+};
+
+/* Returns nanoseconds per pair, forces are written to f. */
+static double _time(_INTERACT_FUNC func, _Pair *pairs, int pairs_count, int repeats, double *f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+        for (int i = 0; i < pairs_count; ++i) {
+            _Pair *p = pairs + i;
+            func(p->prism1, p->prism2, p->dx, p->dy, p->dz, f + i * 3);
+        }
+    auto end = std::chrono::steady_clock::now();
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return ns / ((double)repeats * pairs_count);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: boids-bench <dump> [repeats]\n");
+        return 1;
+    }
+    int repeats = (argc > 2) ? atoi(argv[2]) : 1000;
+    if (repeats < 1)
+        repeats = 1;
+
+    boids_core_init();
+
+    static Model model;
+    boids_core_load(&model, argv[1]);
+
+    /* prisms are in object CS, so objects can be put back where they were dumped */
+    vec3 dumped_p[MAX_ELEMS];
+    for (int i = 0; i < model.objects_count; ++i)
+        dumped_p[i] = model.objects[i]->p;
+    boids_core_collide(&model, false); /* builds object prisms */
+    for (int i = 0; i < model.objects_count; ++i)
+        model.objects[i]->p = dumped_p[i];
+
+    /* record prism pairs */
+    int max_pairs = model.objects_count * model.objects_count / 2 * MAX_OBJECT_FORMERS * MAX_OBJECT_FORMERS;
+    _Pair *pairs = (_Pair *)malloc(sizeof(_Pair) * (max_pairs + 1));
+    int pairs_count = 0;
+    for (int i = 0; i < model.objects_count; ++i) {
+        Object *o1 = model.objects[i];
+        for (int j = i + 1; j < model.objects_count; ++j) {
+            Object *o2 = model.objects[j];
+            for (int k = 0; k < o1->prisms_count; ++k)
+                for (int l = 0; l < o2->prisms_count; ++l) {
+                    _Pair *p = pairs + pairs_count;
+                    p->prism1 = o1->prisms + k;
+                    p->prism2 = o2->prisms + l;
+                    p->dx = (double)o2->p.x - o1->p.x;
+                    p->dy = (double)o2->p.y - o1->p.y;
+                    p->dz = (double)o2->p.z - o1->p.z;
+                    if (p->prism1->min_x <= p->prism2->max_x + p->dx && p->prism1->max_x >= p->prism2->min_x + p->dx)
+                        ++pairs_count;
+                }
+        }
+    }
+    if (pairs_count == 0) {
+        fprintf(stderr, "no overlapping prism pairs in %s\n", argv[1]);
+        return 1;
+    }
+
+    double *f_scalar = (double *)malloc(sizeof(double) * 3 * pairs_count);
+    double *f_kernel = (double *)malloc(sizeof(double) * 3 * pairs_count);
+    double ns_scalar = _time(coll_interact_prisms_scalar, pairs, pairs_count, repeats, f_scalar);
+    double ns_kernel = _time(coll_interact_prisms, pairs, pairs_count, repeats, f_kernel);
+
+    int interacting = 0;
+    double max_diff = 0.0;
+    for (int i = 0; i < pairs_count * 3; ++i) {
+        double diff = fabs(f_scalar[i] - f_kernel[i]);
+        if (diff > max_diff)
+            max_diff = diff;
+    }
+    for (int i = 0; i < pairs_count; ++i)
+        if (f_scalar[i * 3 + 1] != 0.0 || f_scalar[i * 3 + 2] != 0.0)
+            ++interacting;
+
+    printf("%d prism pairs, %d interacting\n", pairs_count, interacting);
+    printf("scalar %8.1f ns/pair\n", ns_scalar);
+    printf("%-6s %8.1f ns/pair, %.2fx, max force difference %g\n", coll_interact_prisms_kind(), ns_kernel, ns_scalar / ns_kernel, max_diff);
+
+    free(pairs);
+    free(f_scalar);
+    free(f_kernel);
+    return 0;
+}
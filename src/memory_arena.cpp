@@ -2,43 +2,161 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <mutex>
 
 
-Arena::Arena(int _capacity) {
-    capacity = _capacity;
-    data = (char *)malloc(capacity);
+struct ArenaBlock {
+    ArenaBlock *next;
+    int64_t capacity;
+};
+
+static Arena *arenas = 0; /* all arenas, for reporting */
+static std::mutex arenas_mutex; /* arenas are created by loft and collision contexts on any thread */
+
+static ArenaBlock *_make_block(int64_t capacity) {
+    ArenaBlock *b = (ArenaBlock *)malloc(sizeof(ArenaBlock) + capacity);
+    assert(b);
+    b->next = 0;
+    b->capacity = capacity;
+    return b;
+}
+
+static void _free_blocks(ArenaBlock *b) {
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+static void _set_block(Arena *a, ArenaBlock *b) {
+    a->block = b;
+    a->data = (char *)(b + 1);
+    a->capacity = b->capacity;
+}
+
+/* Makes room for at least bytes at the end of the arena. */
+static void _grow(Arena *a, int64_t bytes) {
+    ++a->grows;
+
+    if (a->growth == ARENA_CONTIGUOUS) { /* move everything into a larger block */
+        int64_t capacity = a->capacity * 2;
+        if (capacity < a->taken + bytes)
+            capacity = a->taken + bytes;
+        ArenaBlock *b = _make_block(capacity);
+        memcpy(b + 1, a->data, a->taken);
+        free(a->first);
+        a->first = b;
+        _set_block(a, b);
+    }
+    else { /* continue in the next block, reuse it if it's large enough */
+        ArenaBlock *b = a->block->next;
+        if (b == 0 || b->capacity < bytes) {
+            b = _make_block((bytes > a->block_size) ? bytes : a->block_size);
+            b->next = a->block->next;
+            a->block->next = b;
+        }
+        a->used += a->taken;
+        a->taken = 0;
+        _set_block(a, b);
+    }
+}
+
+static void _update_high_water(Arena *a) {
+    if (a->used + a->taken > a->high_water)
+        a->high_water = a->used + a->taken;
+}
+
+Arena::Arena(int64_t _block_size, ArenaGrowth _growth, const char *_name) {
+    block_size = _block_size;
+    growth = _growth;
+    name = _name;
+    first = _make_block(block_size);
+    _set_block(this, first);
     taken = 0;
+    used = 0;
+    high_water = 0;
+    grows = 0;
     locked_stack = 0;
+    std::lock_guard<std::mutex> lock(arenas_mutex);
+    next_arena = arenas;
+    arenas = this;
 }
 
 Arena::~Arena() {
-    free(data);
+    _free_blocks(first);
+    std::lock_guard<std::mutex> lock(arenas_mutex);
+    for (Arena **a = &arenas; *a; a = &(*a)->next_arena)
+        if (*a == this) {
+            *a = next_arena;
+            break;
+        }
 }
 
 void Arena::clear() {
+    if (first->next) { /* merge blocks so the arena doesn't have to grow next time */
+        int64_t total = 0;
+        for (ArenaBlock *b = first; b; b = b->next)
+            total += b->capacity;
+        _free_blocks(first);
+        first = _make_block(total);
+    }
+    _set_block(this, first);
     taken = 0;
+    used = 0;
     locked_stack = 0;
 }
 
 void Arena::unlock() {
-    if (locked_stack > 0)
-        taken -= lock_stack[--locked_stack];
+    if (locked_stack > 0) {
+        ArenaLock *l = lock_stack + --locked_stack;
+        if (growth == ARENA_CHUNKED)
+            _set_block(this, l->block);
+        taken = l->taken;
+        used = l->used;
+    }
 }
 
-char *Arena::alloc_bytes(int bytes, bool zero) {
-    assert(taken + bytes < capacity);
+char *Arena::alloc_bytes(int64_t bytes, bool zero) {
     assert(locked_stack == 0);
+    if (taken + bytes > capacity)
+        _grow(this, bytes);
     char *mem = data + taken;
     taken += bytes;
+    _update_high_water(this);
     if (zero)
         memset(mem, 0, bytes);
     return mem;
 }
 
-char *Arena::lock_bytes(int bytes) {
-    assert(taken + bytes < capacity);
+char *Arena::lock_bytes(int64_t bytes) {
+    assert(locked_stack < MAX_LOCK_STACK);
+    if (taken + bytes > capacity)
+        _grow(this, bytes);
+    ArenaLock *l = lock_stack + locked_stack++; /* unlocking returns to start of locked memory, so it can be allocated right after */
+    l->block = block;
+    l->taken = taken;
+    l->used = used;
     char *mem = data + taken;
     taken += bytes;
-    lock_stack[locked_stack++] = bytes;
+    _update_high_water(this);
     return mem;
 }
+
+char *Arena::reserve_bytes(int64_t bytes) {
+    if (taken + bytes > capacity)
+        _grow(this, bytes);
+    return data + taken;
+}
+
+/* Prints high-water marks of all arenas. */
+void arena_report(FILE *file) {
+    std::lock_guard<std::mutex> lock(arenas_mutex);
+    for (Arena *a = arenas; a; a = a->next_arena) {
+        int64_t capacity = 0;
+        for (ArenaBlock *b = a->first; b; b = b->next)
+            capacity += b->capacity;
+        fprintf(file, "arena %-12s %12lld bytes high-water, %12lld capacity, grew %d times\n",
+                a->name ? a->name : "-", (long long)a->high_water, (long long)capacity, a->grows);
+    }
+}
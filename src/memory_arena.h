@@ -1,38 +1,82 @@
 #ifndef arena_h
 #define arena_h
 
+#include <stdint.h>
+#include <stdio.h>
+
 #define MAX_LOCK_STACK 8
 
 
+/* How an arena grows when it runs out of space. Chunked arenas link a new block
+and never move memory, so pointers stay valid until clear(), but only memory
+within a block is contiguous; reserve() space before writing to rest(). Contiguous
+arenas move everything into a larger block, so all memory since clear() is
+contiguous but growing invalidates pointers; use base() or indices. */
+enum ArenaGrowth {
+    ARENA_CHUNKED,
+    ARENA_CONTIGUOUS
+};
+
+struct ArenaBlock;
+
+struct ArenaLock {
+    ArenaBlock *block;
+    int64_t taken;
+    int64_t used;
+};
+
 struct Arena {
-    char *data;
-    int capacity;
-    int taken;
-    int lock_stack[MAX_LOCK_STACK];
+    char *data;                 /* current block */
+    int64_t capacity;           /* of current block */
+    int64_t taken;              /* in current block */
+    int64_t used;               /* in blocks before the current one */
+    int64_t block_size;         /* minimum size of a new block */
+    int64_t high_water;         /* most bytes ever taken at the same time */
+    int grows;                  /* times the arena had to grow */
+    ArenaGrowth growth;
+    ArenaBlock *first, *block;
+    ArenaLock lock_stack[MAX_LOCK_STACK];
     int locked_stack; // TODO: rename to lock_stack_level
+    const char *name;
+    Arena *next_arena;          /* all arenas, for reporting */
 
-    Arena(int _capacity);
+    Arena(int64_t _block_size, ArenaGrowth _growth=ARENA_CHUNKED, const char *_name=0);
     ~Arena();
 
     void clear();
     void unlock();
-    char *alloc_bytes(int bytes, bool zero);
-    char *lock_bytes(int bytes);
+    char *alloc_bytes(int64_t bytes, bool zero);
+    char *lock_bytes(int64_t bytes);
+    char *reserve_bytes(int64_t bytes);
 
     template<typename T>
-    T *alloc(int count=1, bool zero=false) {
+    T *alloc(int64_t count=1, bool zero=false) {
         return (T *)alloc_bytes(sizeof(T) * count, zero);
     }
 
     template<typename T>
-    T *lock(int count=1) {
+    T *lock(int64_t count=1) {
         return (T *)lock_bytes(sizeof(T) * count);
     }
 
+    /* Makes sure there's room for count contiguous elements at rest(). */
+    template<typename T>
+    T *reserve(int64_t count) {
+        return (T *)reserve_bytes(sizeof(T) * count);
+    }
+
     template<typename T>
     T *rest() {
         return (T *)(data + taken);
     }
+
+    /* Start of all the memory taken since clear(), contiguous arenas only. */
+    template<typename T>
+    T *base() {
+        return (T *)data;
+    }
 };
 
+void arena_report(FILE *file);
+
 #endif
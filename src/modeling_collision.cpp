@@ -4,73 +4,242 @@
 #include <float.h>
 #include <assert.h>
 
+/* Segment intersections are tested several at a time with whatever vector instructions the
+build targets, x64 always has SSE2. Defining COLL_NO_SIMD forces the scalar version. */
+#if defined(COLL_NO_SIMD)
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define _COLL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define _COLL_SSE2
+#endif
+
+#define _MAX_ISECTS 32
+
+
+struct _Isect {
+    double x, y;
+    int indices[2]; // node indices on respective curves
+    bool is_start;
+};
+
+typedef int (*_FIND_ISECTS_FUNC)(CollPrism *prism1, CollPrism *prism2, _Isect *isects);
 
 void coll_get_prism(Shape *s, CollPrism *prism, double dx, double dy, double margin) {
     Shape transformed_s;
+    dvec verts[COLL_PRISM_VERTS];
     shape_copy_curves(s->curves, transformed_s.curves, dx, dy, margin);
-    shape_get_vertices(&transformed_s, COLL_PRISM_VERTS, prism->verts);
+    shape_get_vertices(&transformed_s, COLL_PRISM_VERTS, verts);
+    for (int i = 0; i < COLL_PRISM_VERTS; ++i) {
+        int next_i = (i + 1) % COLL_PRISM_VERTS;
+        prism->xs[i] = verts[i].x;
+        prism->ys[i] = verts[i].y;
+        prism->exs[i] = verts[i].x - verts[next_i].x;
+        prism->eys[i] = verts[i].y - verts[next_i].y;
+    }
 }
 
-bool coll_interact_prisms(CollPrism *prism1, CollPrism *prism2, double *f) {
-    f[0] = f[1] = f[2] = 0.0;
-
-    if (prism1->min_x > prism2->max_x || prism1->max_x < prism2->min_x) // prisms don't overlap along x
-        return false;
+/* Adds intersection of i-th segment of the first prism with j-th segment of the second prism,
+t is the intersection parameter along the first segment. */
+static void _add_isect(CollPrism *prism1, CollPrism *prism2, int i, int j, double t, _Isect *isects, int *isects_count) {
+    double _dx1 = prism1->exs[i];
+    double _dy1 = prism1->eys[i];
+    double _dx2 = prism2->exs[j];
+    double _dy2 = prism2->eys[j];
+
+    assert(*isects_count < _MAX_ISECTS);
+    _Isect &isect = isects[(*isects_count)++];
+    isect.x = prism1->xs[i] - t * _dx1;
+    isect.y = prism1->ys[i] - t * _dy1;
+    isect.indices[0] = (i + 1) % COLL_PRISM_VERTS;
+    isect.indices[1] = (j + 1) % COLL_PRISM_VERTS;
+    isect.is_start = (-_dx2 * _dy1 + -_dy2 * -_dx1) < 0.0;
+}
 
-    struct Isect {
-        double x, y;
-        int indices[2]; // node indices on respective curves
-        bool is_start;
-    } isects[32];
+/* Finds all intersections of prism segments, in order of segments of the first prism. */
+static int _find_isects_scalar(CollPrism *prism1, CollPrism *prism2, _Isect *isects) {
     int isects_count = 0;
 
-    // find all intersection points
-
     for (int i = 0; i < COLL_PRISM_VERTS; ++i) {
-        int next_i = (i + 1) % COLL_PRISM_VERTS;
+        double _dx1 = prism1->exs[i];
+        double _dy1 = prism1->eys[i];
+
+        for (int j = 0; j < COLL_PRISM_VERTS; ++j) {
+            double _dx2 = prism2->exs[j];
+            double _dy2 = prism2->eys[j];
+
+            double det = _dx1 * _dy2 - _dy1 * _dx2;
+            if (!(fabs(det) >= 0.0001)) // lines are parallel or coincident
+                continue;
 
-        dvec n11 = prism1->verts[i];
-        dvec n12 = prism1->verts[next_i];
+            double _dx12 = prism1->xs[i] - prism2->xs[j];
+            double _dy12 = prism1->ys[i] - prism2->ys[j];
 
-        double _dx1 = n11.x - n12.x;
-        double _dy1 = n11.y - n12.y;
+            /* t and u are tested as numerators of t = t_num / det and u = u_num / det, with signs
+            flipped when det is negative, so division is only done for actual intersections */
+            double abs_det = fabs(det);
+            double t_num = (_dx12 * _dy2 - _dy12 * _dx2);
+            if (det < 0.0)
+                t_num = -t_num;
+            if (!(t_num >= 0.0 && t_num < abs_det)) // intersection outside first line segment
+                continue;
 
-        for (int j = 0; j < COLL_PRISM_VERTS; ++j) {
-            int next_j = (j + 1) % COLL_PRISM_VERTS;
+            double u_num = -(_dx1 * _dy12 - _dy1 * _dx12);
+            if (det < 0.0)
+                u_num = -u_num;
+            if (!(u_num >= 0.0 && u_num < abs_det)) // intersection outside second line segment
+                continue;
 
-            dvec n21 = prism2->verts[j];
-            dvec n22 = prism2->verts[next_j];
+            _add_isect(prism1, prism2, i, j, t_num / abs_det, isects, &isects_count);
+        }
+    }
 
-            double _dx2 = n21.x - n22.x;
-            double _dy2 = n21.y - n22.y;
+    return isects_count;
+}
 
-            double det = _dx1 * _dy2 - _dy1 * _dx2;
-            if (fabs(det) < 0.0001) // lines are parallel or coincident
+#if defined(_COLL_AVX)
+
+/* Same as _find_isects_scalar, but tests 4 segments of the second prism at a time. */
+static int _find_isects_simd(CollPrism *prism1, CollPrism *prism2, _Isect *isects) {
+    static_assert(COLL_PRISM_VERTS % 4 == 0, "prism segments have to fill whole vectors");
+    int isects_count = 0;
+
+    const __m256d zero = _mm256_set1_pd(0.0);
+    const __m256d min_det = _mm256_set1_pd(0.0001);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+
+    for (int i = 0; i < COLL_PRISM_VERTS; ++i) {
+        __m256d dx1 = _mm256_set1_pd(prism1->exs[i]);
+        __m256d dy1 = _mm256_set1_pd(prism1->eys[i]);
+        __m256d x1 = _mm256_set1_pd(prism1->xs[i]);
+        __m256d y1 = _mm256_set1_pd(prism1->ys[i]);
+
+        for (int j = 0; j < COLL_PRISM_VERTS; j += 4) {
+            __m256d dx2 = _mm256_loadu_pd(prism2->exs + j);
+            __m256d dy2 = _mm256_loadu_pd(prism2->eys + j);
+
+            __m256d det = _mm256_sub_pd(_mm256_mul_pd(dx1, dy2), _mm256_mul_pd(dy1, dx2));
+            __m256d det_sign = _mm256_and_pd(det, sign);
+            __m256d abs_det = _mm256_andnot_pd(sign, det);
+            __m256d hit = _mm256_cmp_pd(abs_det, min_det, _CMP_GE_OQ);
+            if (_mm256_movemask_pd(hit) == 0)
                 continue;
 
-            double _dx12 = n11.x - n21.x;
-            double _dy12 = n11.y - n21.y;
+            __m256d dx12 = _mm256_sub_pd(x1, _mm256_loadu_pd(prism2->xs + j));
+            __m256d dy12 = _mm256_sub_pd(y1, _mm256_loadu_pd(prism2->ys + j));
+
+            __m256d t_num = _mm256_sub_pd(_mm256_mul_pd(dx12, dy2), _mm256_mul_pd(dy12, dx2));
+            t_num = _mm256_xor_pd(t_num, det_sign);
+            hit = _mm256_and_pd(hit, _mm256_cmp_pd(t_num, zero, _CMP_GE_OQ));
+            hit = _mm256_and_pd(hit, _mm256_cmp_pd(t_num, abs_det, _CMP_LT_OQ));
 
-            double t =  (_dx12 * _dy2 - _dy12 * _dx2) / det;
-            if (t < 0.0 || t >= 1.0) // intersection outside first line segment
+            __m256d u_num = _mm256_sub_pd(_mm256_mul_pd(dx1, dy12), _mm256_mul_pd(dy1, dx12));
+            u_num = _mm256_xor_pd(u_num, _mm256_xor_pd(det_sign, sign));
+            hit = _mm256_and_pd(hit, _mm256_cmp_pd(u_num, zero, _CMP_GE_OQ));
+            hit = _mm256_and_pd(hit, _mm256_cmp_pd(u_num, abs_det, _CMP_LT_OQ));
+
+            int mask = _mm256_movemask_pd(hit);
+            if (mask == 0)
                 continue;
 
-            double u = -(_dx1 * _dy12 - _dy1 * _dx12) / det;
-            if (u < 0.0 || u >= 1.0) // intersection outside second line segment
+            double t_nums[4], abs_dets[4];
+            _mm256_storeu_pd(t_nums, t_num);
+            _mm256_storeu_pd(abs_dets, abs_det);
+            for (int k = 0; k < 4; ++k)
+                if (mask & (1 << k))
+                    _add_isect(prism1, prism2, i, j + k, t_nums[k] / abs_dets[k], isects, &isects_count);
+        }
+    }
+
+    return isects_count;
+}
+
+#elif defined(_COLL_SSE2)
+
+/* Same as _find_isects_scalar, but tests 2 segments of the second prism at a time. */
+static int _find_isects_simd(CollPrism *prism1, CollPrism *prism2, _Isect *isects) {
+    static_assert(COLL_PRISM_VERTS % 2 == 0, "prism segments have to fill whole vectors");
+    int isects_count = 0;
+
+    const __m128d zero = _mm_set1_pd(0.0);
+    const __m128d min_det = _mm_set1_pd(0.0001);
+    const __m128d sign = _mm_set1_pd(-0.0);
+
+    for (int i = 0; i < COLL_PRISM_VERTS; ++i) {
+        __m128d dx1 = _mm_set1_pd(prism1->exs[i]);
+        __m128d dy1 = _mm_set1_pd(prism1->eys[i]);
+        __m128d x1 = _mm_set1_pd(prism1->xs[i]);
+        __m128d y1 = _mm_set1_pd(prism1->ys[i]);
+
+        for (int j = 0; j < COLL_PRISM_VERTS; j += 2) {
+            __m128d dx2 = _mm_loadu_pd(prism2->exs + j);
+            __m128d dy2 = _mm_loadu_pd(prism2->eys + j);
+
+            __m128d det = _mm_sub_pd(_mm_mul_pd(dx1, dy2), _mm_mul_pd(dy1, dx2));
+            __m128d det_sign = _mm_and_pd(det, sign);
+            __m128d abs_det = _mm_andnot_pd(sign, det);
+            __m128d hit = _mm_cmpge_pd(abs_det, min_det);
+            if (_mm_movemask_pd(hit) == 0)
                 continue;
 
-            double x = n11.x - t * _dx1;
-            double y = n11.y - t * _dy1;
+            __m128d dx12 = _mm_sub_pd(x1, _mm_loadu_pd(prism2->xs + j));
+            __m128d dy12 = _mm_sub_pd(y1, _mm_loadu_pd(prism2->ys + j));
 
-            Isect &isect = isects[isects_count++];
-            isect.x = x;
-            isect.y = y;
-            isect.indices[0] = next_i;
-            isect.indices[1] = next_j;
-            isect.is_start = (-_dx2 * _dy1 + -_dy2 * -_dx1) < 0.0;
+            __m128d t_num = _mm_sub_pd(_mm_mul_pd(dx12, dy2), _mm_mul_pd(dy12, dx2));
+            t_num = _mm_xor_pd(t_num, det_sign);
+            hit = _mm_and_pd(hit, _mm_cmpge_pd(t_num, zero));
+            hit = _mm_and_pd(hit, _mm_cmplt_pd(t_num, abs_det));
+
+            __m128d u_num = _mm_sub_pd(_mm_mul_pd(dx1, dy12), _mm_mul_pd(dy1, dx12));
+            u_num = _mm_xor_pd(u_num, _mm_xor_pd(det_sign, sign));
+            hit = _mm_and_pd(hit, _mm_cmpge_pd(u_num, zero));
+            hit = _mm_and_pd(hit, _mm_cmplt_pd(u_num, abs_det));
+
+            int mask = _mm_movemask_pd(hit);
+            if (mask == 0)
+                continue;
+
+            double t_nums[2], abs_dets[2];
+            _mm_storeu_pd(t_nums, t_num);
+            _mm_storeu_pd(abs_dets, abs_det);
+            for (int k = 0; k < 2; ++k)
+                if (mask & (1 << k))
+                    _add_isect(prism1, prism2, i, j + k, t_nums[k] / abs_dets[k], isects, &isects_count);
         }
     }
 
+    return isects_count;
+}
+
+#else
+
+#define _find_isects_simd _find_isects_scalar
+
+#endif
+
+/* Calculates force on first prism from the second one, offset by dx, dy, dz relative to the first. */
+static inline bool _interact_prisms(CollPrism *prism1, CollPrism *_prism2, double dx, double dy, double dz, double *f,
+                                    _FIND_ISECTS_FUNC find_isects) {
+    f[0] = f[1] = f[2] = 0.0;
+
+    if (prism1->min_x > _prism2->max_x + dx || prism1->max_x < _prism2->min_x + dx) // prisms don't overlap along x
+        return false;
+
+    CollPrism _translated;
+    CollPrism *prism2 = &_translated; // second prism in first prism's CS, segments don't change
+    for (int i = 0; i < COLL_PRISM_VERTS; ++i) {
+        prism2->xs[i] = _prism2->xs[i] + dy;
+        prism2->ys[i] = _prism2->ys[i] + dz;
+        prism2->exs[i] = _prism2->exs[i];
+        prism2->eys[i] = _prism2->eys[i];
+    }
+
+    // find all intersection points
+
+    _Isect isects[_MAX_ISECTS];
+    int isects_count = find_isects(prism1, prism2, isects);
+
     if (isects_count == 0)
         return false;
 
@@ -84,8 +253,8 @@ bool coll_interact_prisms(CollPrism *prism1, CollPrism *prism2, double *f) {
     for (int i = 0; i < isects_count; ++i) {
         int next_i = (i + 1) % isects_count;
 
-        Isect &isect = isects[i];
-        Isect &next_isect = isects[next_i];
+        _Isect &isect = isects[i];
+        _Isect &next_isect = isects[next_i];
 
         if (!isect.is_start)
             continue;
@@ -101,16 +270,16 @@ bool coll_interact_prisms(CollPrism *prism1, CollPrism *prism2, double *f) {
         double isect_norm_y =  isect_line_x / isect_length;
 
         for (int k = isect.indices[0]; k != next_isect.indices[0]; k = (k + 1) % COLL_PRISM_VERTS) {
-            double dx = prism1->verts[k].x - isect.x;
-            double dy = prism1->verts[k].y - isect.y;
+            double dx = prism1->xs[k] - isect.x;
+            double dy = prism1->ys[k] - isect.y;
             double d = dx * isect_norm_x + dy * isect_norm_y;
             if (d > max[0])
                 max[0] = d;
         }
 
         for (int k = next_isect.indices[1]; k != isect.indices[1]; k = (k + 1) % COLL_PRISM_VERTS) {
-            double dx = prism2->verts[k].x - isect.x;
-            double dy = prism2->verts[k].y - isect.y;
+            double dx = prism2->xs[k] - isect.x;
+            double dy = prism2->ys[k] - isect.y;
             double d = dx * isect_norm_x + dy * isect_norm_y;
             if (d > max[1])
                 max[1] = d;
@@ -129,3 +298,23 @@ bool coll_interact_prisms(CollPrism *prism1, CollPrism *prism2, double *f) {
 
     return true;
 }
+
+bool coll_interact_prisms(CollPrism *prism1, CollPrism *prism2, double dx, double dy, double dz, double *f) {
+    return _interact_prisms(prism1, prism2, dx, dy, dz, f, _find_isects_simd);
+}
+
+/* Scalar version of coll_interact_prisms, for comparison. */
+bool coll_interact_prisms_scalar(CollPrism *prism1, CollPrism *prism2, double dx, double dy, double dz, double *f) {
+    return _interact_prisms(prism1, prism2, dx, dy, dz, f, _find_isects_scalar);
+}
+
+/* Instructions coll_interact_prisms was built with. */
+const char *coll_interact_prisms_kind() {
+#if defined(_COLL_AVX)
+    return "avx";
+#elif defined(_COLL_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
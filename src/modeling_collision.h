@@ -8,19 +8,22 @@
 
 
 struct Shape;
-struct Arena;
 
+/* Vertices are kept as separate coordinate arrays so several segments can be tested at once. */
 struct CollPrism {
-    dvec verts[COLL_PRISM_VERTS];
+    double xs[COLL_PRISM_VERTS], ys[COLL_PRISM_VERTS];      /* vertices */
+    double exs[COLL_PRISM_VERTS], eys[COLL_PRISM_VERTS];    /* segments, vertex minus next vertex */
     double x, min_x, max_x;
 };
 
 struct CollContext {
-    Arena *arena;
+    double structural_margin;
     bool dragging;
 };
 
 void coll_get_prism(Shape *shape, CollPrism *prism, double dx, double dy, double margin);
-bool coll_interact_prisms(CollPrism *prism1, CollPrism *prism2, double *f);
+bool coll_interact_prisms(CollPrism *prism1, CollPrism *prism2, double dx, double dy, double dz, double *f);
+bool coll_interact_prisms_scalar(CollPrism *prism1, CollPrism *prism2, double dx, double dy, double dz, double *f);
+const char *coll_interact_prisms_kind();
 
 #endif
@@ -4,47 +4,58 @@
 
 static const float _MAX_ONE_SIDE_MERGE_DELAY = 0.5f;
 static const float _MAX_TWO_SIDE_MERGE_DELAY = 0.3f;
-static float _MERGE_DELAY_FACTOR = 1.0f;
 
 static const double _MIN_STRUCTURAL_MARGIN = 0.01;
 static const double _MAX_STRUCTURAL_MARGIN = 2.0;
 
-double LONGITUDINAL_SMOOTHNESS = 0.5;
-
-int SHAPE_CURVE_SAMPLES = MAX_CURVE_SUBDIVS;
-
-double STRUCTURAL_MARGIN = 0.1;
-
 float MESH_ALPHA = 0.2f;
 
-float ONE_SIDE_MERGE_DELAY = _MAX_ONE_SIDE_MERGE_DELAY;
-float ONE_MINUS_ONE_SIDE_MERGE_DELAY = 1.0f - ONE_SIDE_MERGE_DELAY;
-float TWO_SIDE_MERGE_DELAY = _MAX_TWO_SIDE_MERGE_DELAY;
-float ONE_MINUS_TWO_SIDE_MERGE_DELAY = 1.0f - TWO_SIDE_MERGE_DELAY;
+LoftSettings config_default_loft_settings() {
+    LoftSettings s;
+    s.longitudinal_smoothness = 0.5;
+    s.shape_curve_samples = MAX_CURVE_SUBDIVS;
+    s.structural_margin = 0.1;
+    s.one_side_merge_delay = _MAX_ONE_SIDE_MERGE_DELAY;
+    s.two_side_merge_delay = _MAX_TWO_SIDE_MERGE_DELAY;
+    s.collapse_margin = 0.4;
+    s.exact_tracing = false;
+    s.workers_count = 0;
+    return s;
+}
+
+CollisionSettings config_default_collision_settings() {
+    CollisionSettings s;
+    s.max_iterations = 10;
+    s.tolerance = 0.01;
+    s.max_step = 0.5f;
+    s.objects_damping = 1.0f;
+    s.wings_damping = 1.0f;
+    return s;
+}
 
-void config_decrease_shape_samples() {
-    if (SHAPE_CURVE_SAMPLES > MIN_CURVE_SUBDIVS)
-        SHAPE_CURVE_SAMPLES /= 2;
+void config_decrease_shape_samples(LoftSettings *s) {
+    if (s->shape_curve_samples > MIN_CURVE_SUBDIVS)
+        s->shape_curve_samples /= 2;
 }
 
-void config_increase_shape_samples() {
-    if (SHAPE_CURVE_SAMPLES < MAX_CURVE_SUBDIVS)
-        SHAPE_CURVE_SAMPLES *= 2;
+void config_increase_shape_samples(LoftSettings *s) {
+    if (s->shape_curve_samples < MAX_CURVE_SUBDIVS)
+        s->shape_curve_samples *= 2;
 }
 
-void config_decrease_structural_margin() {
-    if (STRUCTURAL_MARGIN > _MIN_STRUCTURAL_MARGIN) {
-        STRUCTURAL_MARGIN /= 1.2;
-        if (STRUCTURAL_MARGIN < _MIN_STRUCTURAL_MARGIN)
-            STRUCTURAL_MARGIN = _MIN_STRUCTURAL_MARGIN;
+void config_decrease_structural_margin(LoftSettings *s) {
+    if (s->structural_margin > _MIN_STRUCTURAL_MARGIN) {
+        s->structural_margin /= 1.2;
+        if (s->structural_margin < _MIN_STRUCTURAL_MARGIN)
+            s->structural_margin = _MIN_STRUCTURAL_MARGIN;
     }
 }
 
-void config_increase_structural_margin() {
-    if (STRUCTURAL_MARGIN < _MAX_STRUCTURAL_MARGIN) {
-        STRUCTURAL_MARGIN *= 1.2;
-        if (STRUCTURAL_MARGIN > _MAX_STRUCTURAL_MARGIN)
-            STRUCTURAL_MARGIN = _MAX_STRUCTURAL_MARGIN;
+void config_increase_structural_margin(LoftSettings *s) {
+    if (s->structural_margin < _MAX_STRUCTURAL_MARGIN) {
+        s->structural_margin *= 1.2;
+        if (s->structural_margin > _MAX_STRUCTURAL_MARGIN)
+            s->structural_margin = _MAX_STRUCTURAL_MARGIN;
     }
 }
 
@@ -60,21 +71,35 @@ void config_increase_mesh_triangle_edge_transparency() {
         MESH_ALPHA = 1.0f;
 }
 
-void _update_merge_delays() {
-    ONE_SIDE_MERGE_DELAY = _MAX_ONE_SIDE_MERGE_DELAY * _MERGE_DELAY_FACTOR;
-    TWO_SIDE_MERGE_DELAY = _MAX_TWO_SIDE_MERGE_DELAY * _MERGE_DELAY_FACTOR;
+/* Both merge delays are scaled by the same factor, which is recovered from the one side delay. */
+static void _update_merge_delays(LoftSettings *s, float factor_incr) {
+    float factor = s->one_side_merge_delay / _MAX_ONE_SIDE_MERGE_DELAY + factor_incr;
+    if (factor < 0.0f)
+        factor = 0.0f;
+    else if (factor > 1.0f)
+        factor = 1.0f;
+    s->one_side_merge_delay = _MAX_ONE_SIDE_MERGE_DELAY * factor;
+    s->two_side_merge_delay = _MAX_TWO_SIDE_MERGE_DELAY * factor;
+}
+
+void config_decrease_merge_interpolation_delay(LoftSettings *s) {
+    _update_merge_delays(s, -0.1f);
+}
+
+void config_increase_merge_interpolation_delay(LoftSettings *s) {
+    _update_merge_delays(s, 0.1f);
+}
+
+void config_decrease_collapse_margin(LoftSettings *s) {
+    if (s->collapse_margin > 0.0)
+        s->collapse_margin -= 0.05;
 }
 
-void config_decrease_merge_interpolation_delay() {
-    _MERGE_DELAY_FACTOR -= 0.1f;
-    if (_MERGE_DELAY_FACTOR < 0.0f)
-        _MERGE_DELAY_FACTOR = 0.0f;
-    _update_merge_delays();
+void config_increase_collapse_margin(LoftSettings *s) {
+    if (s->collapse_margin < 0.5)
+        s->collapse_margin += 0.05;
 }
 
-void config_increase_merge_interpolation_delay() {
-    _MERGE_DELAY_FACTOR += 0.1f;
-    if (_MERGE_DELAY_FACTOR > 1.0f)
-        _MERGE_DELAY_FACTOR = 1.0f;
-    _update_merge_delays();
+void config_toggle_exact_tracing(LoftSettings *s) {
+    s->exact_tracing = !s->exact_tracing;
 }
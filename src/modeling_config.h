@@ -1,25 +1,53 @@
 #ifndef config_h
 #define config_h
 
-extern double LONGITUDINAL_SMOOTHNESS;
-extern int SHAPE_CURVE_SAMPLES;
-extern double STRUCTURAL_MARGIN;
+/* Settings a model is lofted with. Passed to model_loft() so models lofted at the
+same time can use different resolutions and margins. */
+struct LoftSettings {
+    double longitudinal_smoothness;
+    int shape_curve_samples;
+    double structural_margin;
+    float one_side_merge_delay;
+    float two_side_merge_delay;
+    double collapse_margin;
+    bool exact_tracing;     /* trace envelopes with exact predicates in a single pass instead of retrying on numeric uncertainty */
+    int workers_count;      /* threads used for lofting and collision, 0 uses all hardware threads, at most JOBS_MAX_WORKERS (64) */
+};
+
+/* How collision relaxes model elements. Defaults suit interactive use, a few iterations per
+frame, batch layout solving can raise max_iterations to converge in a single run. */
+struct CollisionSettings {
+    int max_iterations;     /* per run */
+    double tolerance;       /* elements are at rest when no force is larger */
+    float max_step;         /* largest distance an element moves in one iteration */
+    float objects_damping;  /* scale steps of objects and wings */
+    float wings_damping;
+};
+
 extern float MESH_ALPHA;
-extern float ONE_SIDE_MERGE_DELAY;
-extern float TWO_SIDE_MERGE_DELAY;
 
-void config_decrease_shape_samples();
-void config_increase_shape_samples();
+LoftSettings config_default_loft_settings();
+CollisionSettings config_default_collision_settings();
+
+void config_decrease_shape_samples(LoftSettings *s);
+void config_increase_shape_samples(LoftSettings *s);
 
-void config_decrease_structural_margin();
-void config_increase_structural_margin();
+void config_decrease_structural_margin(LoftSettings *s);
+void config_increase_structural_margin(LoftSettings *s);
 
 void config_decrease_mesh_triangle_edge_transparency();
 void config_increase_mesh_triangle_edge_transparency();
 
-void config_decrease_merge_interpolation_delay();
-void config_increase_merge_interpolation_delay();
+void config_decrease_merge_interpolation_delay(LoftSettings *s);
+void config_increase_merge_interpolation_delay(LoftSettings *s);
+
+void config_decrease_collapse_margin(LoftSettings *s);
+void config_increase_collapse_margin(LoftSettings *s);
+
+void config_toggle_exact_tracing(LoftSettings *s);
 
 //#define BOIDS_USE_APAME
 
+#define DRAW_CORRS 0 /* just for debugging */
+
 #endif
@@ -1,56 +1,62 @@
 #include "modeling_id.h"
 
 
-static const int _BUCKET = MAX_ELEMS;
+static_assert(MAX_ELEM_REFS % (sizeof(FlagPart) * 8) == 0, "element references have to fill whole flag parts");
 
-static inline unsigned long long int _to_subflag(int i) {
-    return 1ull << i;
+static const int _BUCKET = sizeof(FlagPart) * 8;
+
+static inline FlagPart _to_subflag(int i) {
+    return (FlagPart)1 << (i % _BUCKET);
 }
 
 void flags_init(Flags *f) {
-    f->f0 = f->f1 = 0ull;
+    for (int i = 0; i < FLAGS_PARTS; ++i)
+        f->data[i] = 0ull;
 }
 
 void flags_add(Flags *f, int i) {
-    if (i < _BUCKET)
-        f->f0 |= _to_subflag(i);
-    else
-        f->f1 |= _to_subflag(i - _BUCKET);
+    f->data[i / _BUCKET] |= _to_subflag(i);
 }
 
 void flags_add_flags(Flags *f, Flags *o) {
-    f->f0 |= o->f0;
-    f->f1 |= o->f1;
+    for (int i = 0; i < FLAGS_PARTS; ++i)
+        f->data[i] |= o->data[i];
 }
 
 bool flags_contains(Flags *f, int i) {
-    if (i < _BUCKET)
-        return f->f0 & _to_subflag(i);
-    else
-        return f->f1 & _to_subflag(i - _BUCKET);
+    return (f->data[i / _BUCKET] & _to_subflag(i)) != 0ull;
 }
 
 bool flags_has_anything_other_than(Flags *f, Flags *o) {
-    return (f->f0 & ~o->f0) || (f->f1 & ~o->f1);
+    for (int i = 0; i < FLAGS_PARTS; ++i)
+        if (f->data[i] & ~o->data[i])
+            return true;
+    return false;
 }
 
 bool flags_and(Flags *a, Flags *b) {
-    return (a->f0 & b->f0) || (a->f1 & b->f1);
+    for (int i = 0; i < FLAGS_PARTS; ++i)
+        if (a->data[i] & b->data[i])
+            return true;
+    return false;
 }
 
 bool flags_is_empty(Flags *f) {
-    return f->f0 == 0ull && f->f1 == 0ull;
+    for (int i = 0; i < FLAGS_PARTS; ++i)
+        if (f->data[i] != 0ull)
+            return false;
+    return true;
 }
 
 Flags flags_zero() {
     Flags f;
-    f.f0 = f.f1 = 0ull;
+    flags_init(&f);
     return f;
 }
 
 Flags flags_make(int i) {
     Flags f;
-    f.f0 = f.f1 = 0ull;
+    flags_init(&f);
     flags_add(&f, i);
     return f;
 }
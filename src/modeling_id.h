@@ -5,12 +5,18 @@
 /* Used to determine flags overhead needed for storing clone id flags. */
 #define MAX_SYMMETRIES 2
 
-/* Maximum number of elements (objects, wings) in a model. */
-#define MAX_ELEMS (sizeof(FlagPart) * 8)
+/* Maximum number of elements (objects, wings) in a model. Only sizes flags and a few arrays
+of pointers, so it can be set higher at build time, in multiples of 32. */
+#ifndef MAX_ELEMS
+#define MAX_ELEMS 512
+#endif
 
 /* Maximum number of element references (original objects and their symmetry clones). */
 #define MAX_ELEM_REFS (MAX_ELEMS * MAX_SYMMETRIES)
 
+/* Number of flag parts needed to have a flag for each element reference. */
+#define FLAGS_PARTS ((int)(MAX_ELEM_REFS / (sizeof(FlagPart) * 8)))
+
 
 /* Object or wing id, unique for the model. */
 typedef short int Id;
@@ -20,12 +26,7 @@ typedef unsigned long long int FlagPart;
 
 /* Id flags for model elements. */
 struct Flags {
-    union {
-        FlagPart data[MAX_SYMMETRIES];
-        struct { /* aliases for convenience, only valid if MAX_SYMMETRIES is 2 */
-            FlagPart f0, f1;
-        };
-    };
+    FlagPart data[FLAGS_PARTS];
 };
 
 /* Ids of tailwise and nosewise objects. */
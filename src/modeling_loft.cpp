@@ -39,6 +39,15 @@ bool fuselage_objects_overlap(Oref *a, Oref *b) {
                             cb.x, cb.y, cb.r);
 }
 
+/* Bounds of the object's circle in the y-z plane, only objects whose bounds overlap can overlap. */
+void fuselage_object_bounds(Oref *o, double *min, double *max) {
+    Circle c = _object_circle(o->object, o->is_clone);
+    min[0] = c.x - c.r;
+    min[1] = c.y - c.r;
+    max[0] = c.x + c.r;
+    max[1] = c.y + c.r;
+}
+
 /* Returns true if exactly one of the wing's formers overlaps with the
 referenced object in the y-z plane. */
 bool fuselage_object_and_wing_overlap(Oref *o, Wref *w) {
@@ -5,14 +5,26 @@
 #include "modeling_id.h"
 #include "modeling_shape.h"
 #include "math_dvec.h"
+#include "util_jobs.h"
 
-#define MAX_FUSELAGE_CONNS 32
+/* An object reference side only gets conns to references of a single origin, so
+a fuselage can't have more conns than this. */
+#define MAX_FUSELAGE_CONNS(orefs_count) ((orefs_count) * 2 * MAX_SYMMETRIES)
 
+/* Room for a trace envelope, which visits each polygon vertex at most once, and as much again for
+intersections. Polygons are shape bundles and a fill polygon with at most one vertex per shape.
+Tracing fails if an envelope doesn't fit. */
+#define MAX_TRACE_ENV_POINTS(shapes_count, shape_subdivs) ((shapes_count) * ((shape_subdivs) + 1) * 2)
 
+
+struct vec3;
 struct Wing;
 struct Arena;
 struct Model;
+struct Panel;
 struct Object;
+struct TraceCache;
+struct LoftSettings;
 
 struct StationId {
     short int id; /* required station id, -1 for filler stations */
@@ -70,25 +82,55 @@ struct Conn {
     Oref *nose_o;
 };
 
+/* Element references and conns are allocated in loft context memory when fuselages are grouped. */
 struct Fuselage {
-    Oref orefs[MAX_ELEM_REFS];
+    Oref *orefs;
     int orefs_count;
-    Wref wrefs[MAX_ELEM_REFS];
+    Wref *wrefs;
     int wrefs_count;
-    Conn conns[MAX_FUSELAGE_CONNS];
+    Conn *conns;
     int conns_count;
 };
 
+/* What envelope tracing did, counted over a loft. */
+struct TraceStats {
+    int traced;     /* envelopes traced, the others were taken from trace cache */
+    int retried;    /* envelopes that had to be retraced because of numeric uncertainty */
+    int retries;    /* retraces of all envelopes */
+    int failed;
+};
+
+/* Owns all the memory needed to loft a fuselage. A fuselage is lofted by a single worker and
+workers don't share anything, so different fuselages can be lofted at the same time. Skin
+vertices and panels of all the fuselages lofted by a worker are appended to its output.
+Stations of a fuselage are traced by station workers, each with its own envelope arena. */
+struct LoftWorker {
+    Arena *arena;           /* scratch */
+    Arena *env_arenas[JOBS_MAX_WORKERS]; /* scratch used while tracing envelopes, one per station worker */
+    int station_workers_count;
+    Jobs *station_jobs;     /* station workers, kept between lofts */
+    Arena *mesh_envs_arena; /* scratch used while making mesh envelopes, meshing stages can run at the same time */
+    Arena *verts_arena;     /* skin vertices output, contiguous */
+    Arena *mesh_arena;      /* skin panels output, contiguous */
+    int verts_count;
+    int panels_count;
+    TraceCache *cache;      /* shared by all workers of a loft context */
+    TraceStats trace_stats; /* of all fuselages lofted by the worker */
+    const LoftSettings *settings;
+    Model *model;           /* only used to dump the model when asserting */
+};
+
 /* loft */
 void fuselage_update_conns(Arena *arena, Fuselage *fuselage);
 void fuselage_update_longitudinal_tangents(Fuselage *fuselage);
-void fuselage_loft(Arena *arena, Arena *verts_arena, Model *model, Fuselage *fuselage);
+void fuselage_loft(LoftWorker *worker, Fuselage *fuselage);
 bool fuselage_objects_overlap(Oref *a, Oref *b);
+void fuselage_object_bounds(Oref *o, double *min, double *max);
 bool fuselage_object_and_wing_overlap(Oref *o, Wref *w);
 
 void loft_fuselage_wing_intersections(Arena *arena, Wref *wrefs, int wrefs_count, struct TraceSection *sections, int sections_count);
 
-#define MAX_WING_ISECS_PER_STATION (MAX_ELEM_REFS * 2)
+#define MAX_WING_ISECS_PER_STATION(wrefs_count) ((wrefs_count) * 2)
 
 
 /* Trace envelope point. */
@@ -103,8 +145,9 @@ struct EnvPoint {
 
 /* Trace envelope, generated initially when tracing around the fuselage. */
 struct TraceEnv {
-    EnvPoint points[MAX_ENVELOPE_POINTS];
+    EnvPoint *points;   /* allocated in loft memory */
     int count;
+    int max_count;      /* room for traced points and wing intersections */
     Flags object_like_flags; /* object-like polygons forming this envelope, passed down to corresponding mesh envelope */
 };
 
@@ -112,16 +155,16 @@ struct TraceEnv {
 only one set of shapes and a single envelope, and two shape sets and two envelopes if there's
 a possibility of an opening. */
 struct TraceSection {
-    Shape shapes[MAX_ENVELOPE_SHAPES];      /* actual storage */
-    Shape *t_shapes[MAX_ENVELOPE_SHAPES];   /* aliases, shapes in tailwise direction */
-    Shape *n_shapes[MAX_ENVELOPE_SHAPES];   /* aliases, shapes in nosewise direction */
+    Shape *shapes;      /* actual storage, allocated in loft memory for pipes at the station */
+    Shape **t_shapes;   /* aliases, shapes in tailwise direction */
+    Shape **n_shapes;   /* aliases, shapes in nosewise direction */
     int shapes_count;
     int t_shapes_count;
     int n_shapes_count;
     bool two_envelopes;
     TraceEnv *t_env, *n_env; /* pointers because they migh point at the same thing in arena */
     double x;
-    Wisec wisecs[MAX_WING_ISECS_PER_STATION];
+    Wisec *wisecs;
     int wisecs_count;
 };
 
@@ -143,10 +186,11 @@ struct MeshEnvSlice {
 
 /* Additional vertex info required for meshing, generated from a corresponding trace envelope. */
 struct MeshEnv {
-    MeshPoint points[MAX_ENVELOPE_POINTS];
+    MeshPoint *points;          /* allocated in loft memory */
     int count;
-    MeshEnvSlice slices[MAX_ENVELOPE_POINTS];
+    MeshEnvSlice *slices;       /* allocated in loft memory */
     int slices_count;
+    int max_count;              /* room for points and slices */
     int verts_base_i;           /* index of first vertex in model vertex buffer so we can map envelope points to their vertices */
     float x;                    /* section x, model CS */
     Flags object_like_flags;    /* used for creating merge filter */
@@ -158,24 +202,32 @@ struct Arena;
 
 /* filter */
 dvec mesh_polygonize_shape_bundle(Shape **shapes, int shapes_count, int shape_subdivs, dvec *verts);
-int mesh_find_outermost_shapes_for_subdivision(dvec *verts, dvec centroid, int subdiv_i, double subdiv_da, int shapes_count, int *outermost_shape_indices);
+void mesh_find_outermost_shapes(dvec *verts, dvec centroid, int shape_subdivs, int shapes_count,
+                                int *outermost_counts, int *outermost_shape_indices);
 void mesh_apply_merge_filter(Arena *arena, int shape_subdivs,
                              Shape **t_shapes, int t_shapes_count, MeshEnv *t_env,
                              Shape **n_shapes, int n_shapes_count, MeshEnv *n_env);
 
 /* trace */
-bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs);
+bool mesh_trace_envelope(Arena *env_arena, TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs,
+                         bool exact, int *retries);
+
+/* trace cache, envelopes traced in recent lofts */
+TraceCache *mesh_trace_cache_make();
+void mesh_trace_cache_free(TraceCache *cache);
+void mesh_trace_cache_begin(TraceCache *cache);
+bool mesh_trace_cache_get(TraceCache *cache, TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs, bool exact);
+void mesh_trace_cache_put(TraceCache *cache, TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs, bool exact);
 
 /* envelope */
-void mesh_make_envelopes(Model *model, Arena *verts_arena, float section_x,
+void mesh_make_envelopes(LoftWorker *worker, float section_x,
                          MeshEnv *t_env, TraceEnv *t_trace_env,
                          MeshEnv *n_env, TraceEnv *n_trace_env);
 
 /* mesh */
-void mesh_init(Model *model);
-void mesh_between_two_sections(Model *model, int shape_subdivs,
+void mesh_init(Model *model); /* only with DRAW_CORRS */
+void mesh_between_two_sections(LoftWorker *worker, int shape_subdivs,
                                MeshEnv *t_env, int *t_neighbors_map,
                                MeshEnv *n_env, int *n_neighbors_map);
-void mesh_verts_merge_margin(bool increase); /* just for debugging */
 
 #endif
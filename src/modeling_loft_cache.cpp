@@ -0,0 +1,156 @@
+#include "modeling_loft.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <mutex>
+
+#define _CACHE_BUCKETS      4096
+#define _CACHE_KEEP_LOFTS   2 /* entries not used for this many lofts are dropped */
+
+
+/* Traced envelope together with shapes it was traced from. Shapes and then points
+are stored after the struct, only as many as the envelope has. */
+struct _CacheEntry {
+    uint64_t hash;
+    int generation; /* of the last loft it was used in */
+    int shapes_count;
+    int curve_subdivs;
+    bool exact;     /* traced with exact predicates */
+    int count;
+    Flags object_like_flags;
+    _CacheEntry *next;
+};
+
+struct TraceCache {
+    _CacheEntry *buckets[_CACHE_BUCKETS];
+    int generation;
+    std::mutex mutex; /* station workers of all fuselage workers share the cache */
+};
+
+static uint64_t _hash_bytes(uint64_t h, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static uint64_t _hash_shapes(Shape **shapes, int shapes_count, int curve_subdivs, bool exact) {
+    uint64_t h = 14695981039346656037ull;
+    h = _hash_bytes(h, &curve_subdivs, sizeof(int));
+    h = _hash_bytes(h, &exact, sizeof(bool));
+    for (int i = 0; i < shapes_count; ++i) {
+        h = _hash_bytes(h, shapes[i]->curves, sizeof(Curve) * SHAPE_CURVES);
+        h = _hash_bytes(h, &shapes[i]->ids.tail, sizeof(Id));
+        h = _hash_bytes(h, &shapes[i]->ids.nose, sizeof(Id));
+    }
+    return h;
+}
+
+static Shape *_entry_shapes(_CacheEntry *e) {
+    return (Shape *)(e + 1);
+}
+
+static EnvPoint *_entry_points(_CacheEntry *e) {
+    return (EnvPoint *)(_entry_shapes(e) + e->shapes_count);
+}
+
+static bool _entry_matches(_CacheEntry *e, uint64_t hash, Shape **shapes, int shapes_count, int curve_subdivs, bool exact) {
+    if (e->hash != hash || e->shapes_count != shapes_count || e->curve_subdivs != curve_subdivs || e->exact != exact)
+        return false;
+    for (int i = 0; i < shapes_count; ++i) {
+        Shape *a = _entry_shapes(e) + i;
+        Shape *b = shapes[i];
+        if (memcmp(a->curves, b->curves, sizeof(Curve) * SHAPE_CURVES) != 0 ||
+            a->ids.tail != b->ids.tail || a->ids.nose != b->ids.nose)
+            return false;
+    }
+    return true;
+}
+
+TraceCache *mesh_trace_cache_make() {
+    TraceCache *c = new TraceCache();
+    memset(c->buckets, 0, sizeof(c->buckets));
+    c->generation = 0;
+    return c;
+}
+
+void mesh_trace_cache_free(TraceCache *c) {
+    for (int i = 0; i < _CACHE_BUCKETS; ++i)
+        while (c->buckets[i]) {
+            _CacheEntry *e = c->buckets[i];
+            c->buckets[i] = e->next;
+            free(e);
+        }
+    delete c;
+}
+
+/* Starts a loft, drops entries that weren't used recently. */
+void mesh_trace_cache_begin(TraceCache *c) {
+    ++c->generation;
+    for (int i = 0; i < _CACHE_BUCKETS; ++i) {
+        _CacheEntry **link = c->buckets + i;
+        while (*link) {
+            _CacheEntry *e = *link;
+            if (c->generation - e->generation > _CACHE_KEEP_LOFTS) {
+                *link = e->next;
+                free(e);
+            }
+            else
+                link = &e->next;
+        }
+    }
+}
+
+/* Copies a previously traced envelope for the same shapes into env, returns false if there isn't one. */
+bool mesh_trace_cache_get(TraceCache *c, TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs, bool exact) {
+    uint64_t hash = _hash_shapes(shapes, shapes_count, curve_subdivs, exact);
+    _CacheEntry *e = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        for (e = c->buckets[hash % _CACHE_BUCKETS]; e; e = e->next)
+            if (_entry_matches(e, hash, shapes, shapes_count, curve_subdivs, exact)) {
+                e->generation = c->generation;
+                break;
+            }
+    }
+
+    if (e == 0)
+        return false;
+
+    assert(e->count <= env->max_count);
+    env->count = e->count;
+    env->object_like_flags = e->object_like_flags;
+    memcpy(env->points, _entry_points(e), sizeof(EnvPoint) * e->count);
+    return true;
+}
+
+/* Remembers a successfully traced envelope. */
+void mesh_trace_cache_put(TraceCache *c, TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs, bool exact) {
+    uint64_t hash = _hash_shapes(shapes, shapes_count, curve_subdivs, exact);
+
+    _CacheEntry *e = (_CacheEntry *)malloc(sizeof(_CacheEntry) + sizeof(Shape) * shapes_count + sizeof(EnvPoint) * env->count);
+    e->hash = hash;
+    e->generation = c->generation;
+    e->shapes_count = shapes_count;
+    for (int i = 0; i < shapes_count; ++i)
+        _entry_shapes(e)[i] = *shapes[i];
+    e->curve_subdivs = curve_subdivs;
+    e->exact = exact;
+    e->count = env->count;
+    e->object_like_flags = env->object_like_flags;
+    memcpy(_entry_points(e), env->points, sizeof(EnvPoint) * env->count);
+
+    std::lock_guard<std::mutex> lock(c->mutex);
+    _CacheEntry **bucket = c->buckets + hash % _CACHE_BUCKETS;
+    for (_CacheEntry *o = *bucket; o; o = o->next)
+        if (_entry_matches(o, hash, shapes, shapes_count, curve_subdivs, exact)) { /* same section traced twice */
+            free(e);
+            return;
+        }
+    e->next = *bucket;
+    *bucket = e;
+}
@@ -4,6 +4,7 @@
 #include "math_dvec.h"
 #include <string.h>
 #include <math.h>
+#include <assert.h>
 
 
 /* Intermediate connection representation used while building connections. */
@@ -17,7 +18,8 @@ void fuselage_update_conns(Arena *arena, Fuselage *fuselage) {
 
     /* determine all the possible connected pairs of objects (don't overlap along x) */
 
-    _Conn *conns1 = arena->alloc<_Conn>(MAX_ELEM_REFS * MAX_ELEM_REFS);
+    int max_conns = fuselage->orefs_count * (fuselage->orefs_count - 1) / 2; /* all pairs */
+    _Conn *conns1 = arena->alloc<_Conn>(max_conns);
     int conns1_count = 0;
 
     for (int a_i = 0; a_i < fuselage->orefs_count; ++a_i) {
@@ -51,7 +53,7 @@ void fuselage_update_conns(Arena *arena, Fuselage *fuselage) {
 
     /* create connection candidates by filtering through possible ones */
 
-    _Conn *conns2 = arena->alloc<_Conn>(MAX_ELEM_REFS * MAX_ELEM_REFS);
+    _Conn *conns2 = arena->alloc<_Conn>(conns1_count);
     int conns2_count = 0;
 
     for (int j = 0; j < conns1_count; ++j) {
@@ -103,6 +105,7 @@ void fuselage_update_conns(Arena *arena, Fuselage *fuselage) {
         flags_add_flags(&t_ref->n.non_clone_origins, &n_ref->non_clone_origin);
         flags_add_flags(&n_ref->t.non_clone_origins, &t_ref->non_clone_origin);
 
+        assert(fuselage->conns_count < MAX_FUSELAGE_CONNS(fuselage->orefs_count));
         Conn *c = fuselage->conns + fuselage->conns_count++;
         c->tail_o = fuselage->orefs + c2->t_i;
         c->nose_o = fuselage->orefs + c2->n_i;
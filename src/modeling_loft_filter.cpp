@@ -9,57 +9,120 @@
 #include <string.h>
 #include <assert.h>
 
+/* Dots of bundle points are computed two shapes at a time with SSE2, which x64 always has.
+Defining MESH_NO_SIMD forces the scalar version. */
+#if defined(MESH_NO_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define _MESH_SSE2
+#endif
+
 /* For all the shapes' points in a subdivision only the ones within the _OUTERMOST_MARGIN
 distance from the outermost point (in metres) will be considered as outermost as well. */
 #define _OUTERMOST_MARGIN 1.0e-6
 
+/* Subdivision directions for every number of subdivisions, packed so that directions for count n start
+at n * (n - 1) / 2. */
+#define _DIRS_OFFSET(__n__) ((__n__) * ((__n__) - 1) / 2)
+#define _DIRS_COUNT _DIRS_OFFSET(MAX_SHAPE_SUBDIVS + 1)
+
+struct _DirsTable {
+    dvec dirs[_DIRS_COUNT];
+};
+
+static _DirsTable _make_dirs_table() {
+    _DirsTable table;
+    for (int n = 1; n <= MAX_SHAPE_SUBDIVS; ++n) {
+        dvec *dirs = table.dirs + _DIRS_OFFSET(n);
+        double da = TAU / n;
+        for (int i = 0; i < n; ++i) {
+            double a = i * da;
+            dirs[i].x = cos(a);
+            dirs[i].y = sin(a);
+        }
+    }
+    return table;
+}
+
+static const _DirsTable _dirs_table = _make_dirs_table();
+
 /* For an object-like origin provides shapes of connections connected to that object or bundle.
 All shapes are located on two adjacent fuselage sections. */
 struct _ConnsForObject {
-    Shape *shapes[MAX_ELEM_REFS];
+    Shape **shapes; /* points into storage shared by all object-like origins */
     int count;
 };
 
+/* Id of the object-like origin on the other side a connection shape is connected to, -1 if none. */
+static int _object_like_id(Shape *s, bool is_tail_shape, MeshEnv *other_env) {
+    if (s->ids.tail == s->ids.nose)
+        return -1;
+    int id = is_tail_shape ? s->ids.nose : s->ids.tail;
+    return flags_contains(&other_env->object_like_flags, id) ? id : -1;
+}
+
 /* If any merge transitions are detected between two given mesh envelopes marks appropriate mesh
 points as non-outermost. */
 void mesh_apply_merge_filter(Arena *arena, int shape_subdivs,
                              Shape **t_shapes, int t_shapes_count, MeshEnv *t_env,
                              Shape **n_shapes, int n_shapes_count, MeshEnv *n_env) {
 
-    _ConnsForObject *conns = arena->lock<_ConnsForObject>(MAX_ELEM_REFS);
-    dvec *verts = arena->lock<dvec>(MAX_SHAPE_SUBDIVS * MAX_ELEM_REFS);
-    Flags *filter = arena->lock<Flags>(MAX_SHAPE_SUBDIVS);
+    /* ids of all the shapes are below ids_count */
+
+    int ids_count = 0;
+    for (int i = 0; i < t_shapes_count; ++i)
+        ids_count = max_i(ids_count, max_i(t_shapes[i]->ids.tail, t_shapes[i]->ids.nose) + 1);
+    for (int i = 0; i < n_shapes_count; ++i)
+        ids_count = max_i(ids_count, max_i(n_shapes[i]->ids.tail, n_shapes[i]->ids.nose) + 1);
 
     /* collect all connection shapes on one side for each object-like shape on the other */
 
-    memset(conns, 0, sizeof(_ConnsForObject) * MAX_ELEM_REFS);
+    _ConnsForObject *conns = arena->lock<_ConnsForObject>(ids_count);
+    Shape **conn_shapes = arena->lock<Shape *>(t_shapes_count + n_shapes_count);
+    memset(conns, 0, sizeof(_ConnsForObject) * ids_count);
 
-    for (int i = 0; i < t_shapes_count; ++i) {
-        Shape *s = t_shapes[i];
-        if (s->ids.tail != s->ids.nose && flags_contains(&n_env->object_like_flags, s->ids.nose)) {
-            _ConnsForObject *c = conns + s->ids.nose;
-            c->shapes[c->count++] = s;
-        }
+    for (int i = 0; i < t_shapes_count; ++i) { /* count first */
+        int id = _object_like_id(t_shapes[i], true, n_env);
+        if (id != -1)
+            ++conns[id].count;
+    }
+    for (int i = 0; i < n_shapes_count; ++i) {
+        int id = _object_like_id(n_shapes[i], false, t_env);
+        if (id != -1)
+            ++conns[id].count;
     }
 
+    int max_conns_count = 0;
+    for (int i = 0, offset = 0; i < ids_count; ++i) {
+        _ConnsForObject *c = conns + i;
+        max_conns_count = max_i(max_conns_count, c->count);
+        c->shapes = conn_shapes + offset;
+        offset += c->count;
+        c->count = 0; /* reset so shapes can be added */
+    }
+
+    for (int i = 0; i < t_shapes_count; ++i) {
+        int id = _object_like_id(t_shapes[i], true, n_env);
+        if (id != -1)
+            conns[id].shapes[conns[id].count++] = t_shapes[i];
+    }
     for (int i = 0; i < n_shapes_count; ++i) {
-        Shape *s = n_shapes[i];
-        if (s->ids.tail != s->ids.nose && flags_contains(&t_env->object_like_flags, s->ids.tail)) {
-            _ConnsForObject *c = conns + s->ids.tail;
-            c->shapes[c->count++] = s;
-        }
+        int id = _object_like_id(n_shapes[i], false, t_env);
+        if (id != -1)
+            conns[id].shapes[conns[id].count++] = n_shapes[i];
     }
 
-    /* for each object-like shape that transitions into multiple connections form and apply filter */
+    dvec *verts = arena->lock<dvec>(MAX_SHAPE_SUBDIVS * max_conns_count);
+    int *outermost_shape_indices = arena->lock<int>(MAX_SHAPE_SUBDIVS * max_conns_count);
+    Flags *filter = arena->lock<Flags>(MAX_SHAPE_SUBDIVS);
 
-    double subdiv_da = TAU / shape_subdivs;
+    /* for each object-like shape that transitions into multiple connections form and apply filter */
 
-    for (int object_like_i = 0; object_like_i < MAX_ELEM_REFS; ++object_like_i) {
+    for (int object_like_i = 0; object_like_i < ids_count; ++object_like_i) {
         _ConnsForObject *c = conns + object_like_i;
 
-        Flags object_like_flag = flags_make(object_like_i);
-        bool t_is_object_like = flags_and(&t_env->object_like_flags, &object_like_flag);
-        bool n_is_object_like = flags_and(&n_env->object_like_flags, &object_like_flag);
+        bool t_is_object_like = flags_contains(&t_env->object_like_flags, object_like_i);
+        bool n_is_object_like = flags_contains(&n_env->object_like_flags, object_like_i);
 
         /* if object-like on one side and multiple connections on other side */
 
@@ -69,14 +132,15 @@ void mesh_apply_merge_filter(Arena *arena, int shape_subdivs,
 
             memset(filter, 0, sizeof(Flags) * shape_subdivs); /* reset filter */
 
-            static int outermost_shape_indices[MAX_ELEM_REFS];
+            int outermost_counts[MAX_SHAPE_SUBDIVS];
             dvec centroid = mesh_polygonize_shape_bundle(c->shapes, c->count, shape_subdivs, verts);
+            mesh_find_outermost_shapes(verts, centroid, shape_subdivs, c->count, outermost_counts, outermost_shape_indices);
 
             for (int subdiv_i = 0; subdiv_i < shape_subdivs; ++subdiv_i) {
-                int count = mesh_find_outermost_shapes_for_subdivision(verts, centroid, subdiv_i, subdiv_da, c->count, outermost_shape_indices);
+                int *subdiv_indices = outermost_shape_indices + subdiv_i * c->count;
 
-                for (int j = 0; j < count; ++j) {
-                    Shape *shape = c->shapes[outermost_shape_indices[j]];
+                for (int j = 0; j < outermost_counts[subdiv_i]; ++j) {
+                    Shape *shape = c->shapes[subdiv_indices[j]];
                     if (t_is_object_like)
                         flags_add(filter + subdiv_i, shape->ids.nose);
                     else
@@ -94,12 +158,10 @@ void mesh_apply_merge_filter(Arena *arena, int shape_subdivs,
                     if (slice->ids.tail != object_like_i)
                         continue;
 
-                    Flags conn_flag = flags_make(slice->ids.nose);
-
                     for (int j = slice->beg; ; j = period_incr(j, n_env->count)) {
                         MeshPoint *p = n_env->points + j;
 
-                        if (!flags_and(filter + p->subdiv_i, &conn_flag))
+                        if (!flags_contains(filter + p->subdiv_i, slice->ids.nose))
                             p->t_is_outermost = false;
 
                         if (j == slice->end)
@@ -115,12 +177,10 @@ void mesh_apply_merge_filter(Arena *arena, int shape_subdivs,
                     if (slice->ids.nose != object_like_i)
                         continue;
 
-                    Flags conn_flag = flags_make(slice->ids.tail);
-
                     for (int j = slice->beg; ; j = period_incr(j, t_env->count)) {
                         MeshPoint *p = t_env->points + j;
 
-                        if (!flags_and(filter + p->subdiv_i, &conn_flag))
+                        if (!flags_contains(filter + p->subdiv_i, slice->ids.tail))
                             p->n_is_outermost = false;
 
                         if (j == slice->end)
@@ -134,33 +194,13 @@ void mesh_apply_merge_filter(Arena *arena, int shape_subdivs,
     arena->unlock();
     arena->unlock();
     arena->unlock();
+    arena->unlock();
+    arena->unlock();
 }
 
 /* Sample vertices for given shapes, putting all vertices for a subdivision next to each other. */
 dvec mesh_polygonize_shape_bundle(Shape **shapes, int shapes_count, int shape_subdivs, dvec *verts) {
-    int curve_subdivs = shape_subdivs / SHAPE_CURVES;
-    double dt = 1.0 / curve_subdivs;
-
-    for (int prev_curve_i = 0; prev_curve_i < SHAPE_CURVES; ++prev_curve_i) {
-        int next_curve_i = (prev_curve_i + 1) % SHAPE_CURVES;
-
-        for (int curve_subdiv_i = 0; curve_subdiv_i < curve_subdivs; ++curve_subdiv_i) {
-            int subdiv_base = (prev_curve_i * curve_subdivs + curve_subdiv_i) * shapes_count;
-            dvec *subdiv_verts = verts + subdiv_base;
-            double t = curve_subdiv_i * dt;
-
-            for (int shape_i = 0; shape_i < shapes_count; ++shape_i) {
-                Shape *shape = shapes[shape_i];
-                Curve *curve1 = shape->curves + prev_curve_i;
-                Curve *curve2 = shape->curves + next_curve_i;
-
-                subdiv_verts[shape_i] = shape_bezier(curve1->x, curve1->y,
-                                                     curve1->cx, curve1->cy,
-                                                     curve2->x, curve2->y,
-                                                     t, curve1->w);
-            }
-        }
-    }
+    shape_sample_bundle(shapes, shapes_count, shape_subdivs / SHAPE_CURVES, verts);
 
     /* calculate bundle centroid */
 
@@ -180,49 +220,62 @@ dvec mesh_polygonize_shape_bundle(Shape **shapes, int shapes_count, int shape_su
     return centroid;
 }
 
-/* Identifies shapes (by index) whose point for the given subdivision is outermost. Returns number of found
-shapes since multiple shapes can have outermost points. */
-int mesh_find_outermost_shapes_for_subdivision(dvec *verts, dvec centroid, int subdiv_i, double subdiv_da, int shapes_count, int *outermost_shape_indices) {
-    dvec *subdiv_verts = verts + subdiv_i * shapes_count;
-    double subdiv_a = subdiv_i * subdiv_da;
-    double nx = cos(subdiv_a);
-    double ny = sin(subdiv_a);
+/* Identifies shapes (by index) whose points are outermost, for all subdivisions of a bundle at once. Multiple
+shapes can have outermost points in a subdivision, their number is put in outermost_counts[subdiv_i] and their
+indices, in ascending order, at outermost_shape_indices + subdiv_i * shapes_count. */
+void mesh_find_outermost_shapes(dvec *verts, dvec centroid, int shape_subdivs, int shapes_count,
+                                int *outermost_counts, int *outermost_shape_indices) {
+    assert(shape_subdivs <= MAX_SHAPE_SUBDIVS);
+    assert(shapes_count > 0 && shapes_count <= MAX_ELEM_REFS);
+    const dvec *dirs = _dirs_table.dirs + _DIRS_OFFSET(shape_subdivs);
+    double dots[MAX_ELEM_REFS];
+
+    for (int subdiv_i = 0; subdiv_i < shape_subdivs; ++subdiv_i) {
+        dvec *subdiv_verts = verts + subdiv_i * shapes_count;
+        double nx = dirs[subdiv_i].x;
+        double ny = dirs[subdiv_i].y;
+
+        /* calculate points' dot (outermostness) and the largest one */
+
+        double max_dot = -DBL_MAX;
+        int i = 0;
+
+#ifdef _MESH_SSE2
+        __m128d _nx = _mm_set1_pd(nx), _ny = _mm_set1_pd(ny);
+        __m128d _cx = _mm_set1_pd(centroid.x), _cy = _mm_set1_pd(centroid.y);
+        __m128d _max_dot = _mm_set1_pd(-DBL_MAX);
+
+        for (; i + 2 <= shapes_count; i += 2) {
+            __m128d v1 = _mm_loadu_pd(&subdiv_verts[i].x);
+            __m128d v2 = _mm_loadu_pd(&subdiv_verts[i + 1].x);
+            __m128d vx = _mm_sub_pd(_mm_unpacklo_pd(v1, v2), _cx);
+            __m128d vy = _mm_sub_pd(_mm_unpackhi_pd(v1, v2), _cy);
+            __m128d dot = _mm_add_pd(_mm_mul_pd(_nx, vx), _mm_mul_pd(_ny, vy));
+            _mm_storeu_pd(dots + i, dot);
+            _max_dot = _mm_max_pd(_max_dot, dot);
+        }
 
-    /* calculate points' dot (outermostness) and sort them */
+        _max_dot = _mm_max_pd(_max_dot, _mm_unpackhi_pd(_max_dot, _max_dot));
+        max_dot = _mm_cvtsd_f64(_max_dot);
+#endif
 
-    static struct _Dot {
-        double dot;
-        int index;
-    } vert_dots[MAX_ELEM_REFS];
+        for (; i < shapes_count; ++i) {
+            double vx = subdiv_verts[i].x - centroid.x;
+            double vy = subdiv_verts[i].y - centroid.y;
+            dots[i] = nx * vx + ny * vy;
+            if (dots[i] > max_dot)
+                max_dot = dots[i];
+        }
 
-    for (int i = 0; i < shapes_count; ++i) {
-        double vx = subdiv_verts[i].x - centroid.x;
-        double vy = subdiv_verts[i].y - centroid.y;
-        double dot = nx * vx + ny * vy;
+        /* points close enough to the outermost one are outermost as well */
 
-        int ins_i = 0;
-        for (; ins_i < i; ++ins_i) /* find insertion point */
-            if (vert_dots[ins_i].dot < dot)
-                break;
+        int *subdiv_indices = outermost_shape_indices + subdiv_i * shapes_count;
+        int outermost_count = 0;
 
-        for (int j = i; j > ins_i; --j) /* make room for insertion */
-            vert_dots[j] = vert_dots[j - 1];
+        for (i = 0; i < shapes_count; ++i)
+            if (max_dot - dots[i] < _OUTERMOST_MARGIN)
+                subdiv_indices[outermost_count++] = i;
 
-        /* insert new dot */
-        vert_dots[ins_i].dot = dot;
-        vert_dots[ins_i].index = i;
+        outermost_counts[subdiv_i] = outermost_count;
     }
-
-    /* determine how many of the outermost points are actually suitable */
-
-    outermost_shape_indices[0] = vert_dots[0].index; /* first outermost point is automatically added */
-    int outermost_count = 1;
-
-    for (int i = 1; i < shapes_count; ++i) /* find runners up that are close enough to the first point */
-        if (fabs(vert_dots[0].dot - vert_dots[i].dot) < _OUTERMOST_MARGIN)
-            outermost_shape_indices[outermost_count++] = vert_dots[i].index;
-        else
-            break;
-
-    return outermost_count;
 }
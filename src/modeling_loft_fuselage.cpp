@@ -6,11 +6,15 @@
 #include "math_interp.h"
 #include "math_periodic.h"
 #include "memory_arena.h"
+#include "util_jobs.h"
 #include <math.h>
 #include <float.h>
+#include <string.h>
 #include <assert.h>
+#include <mutex>
+#include <condition_variable>
 
-#define _MAX_FUSELAGE_STATIONS 1000
+#define _MESH_SECTIONS_RING     4 /* mesh sections in flight when pipelining */
 
 
 /* Marks position of fuselage sections. */
@@ -50,7 +54,7 @@ static int _insert_station(_Station *stations, int *count, float x) {
 
 /* Returns a shape that represents a section of object or connection (pair of
 formers with associated longitudinal tangents). */
-static void _get_section_shape(float x, Shape *shape,
+static void _get_section_shape(const LoftSettings *settings, float x, Shape *shape,
                                Former *t_form, tvec *t_tangents, bool t_is_merge,
                                Former *n_form, tvec *n_tangents, bool n_is_merge) {
     Curve *t_curves = t_form->shape.curves;
@@ -59,7 +63,7 @@ static void _get_section_shape(float x, Shape *shape,
     float min_x = t_form->x;
     float max_x = n_form->x;
     float dx = max_x - min_x;
-    float dc = dx * (float)LONGITUDINAL_SMOOTHNESS;
+    float dc = dx * (float)settings->longitudinal_smoothness;
 
     float t = (x - min_x) / dx;
 
@@ -94,16 +98,16 @@ static void _get_section_shape(float x, Shape *shape,
         float f1, f2;
 
         if (t_is_merge && n_is_merge) {
-            f1 = TWO_SIDE_MERGE_DELAY;
-            f2 = 1.0f - TWO_SIDE_MERGE_DELAY;
+            f1 = settings->two_side_merge_delay;
+            f2 = 1.0f - settings->two_side_merge_delay;
         }
         else if (t_is_merge) {
-            f1 = ONE_SIDE_MERGE_DELAY;
+            f1 = settings->one_side_merge_delay;
             f2 = 1.0f;
         }
         else if (n_is_merge) {
             f1 = 0.0f;
-            f2 = 1.0f - ONE_SIDE_MERGE_DELAY;
+            f2 = 1.0f - settings->one_side_merge_delay;
         }
         else {
             f1 = 0.0f;
@@ -121,18 +125,274 @@ static void _get_section_shape(float x, Shape *shape,
     shape_update_curve_control_points(shape->curves);
 }
 
+/* Shared, read-only data for creating and tracing sections at stations. */
+struct _TraceJobs {
+    LoftWorker *worker;
+    Fuselage *fuselage;
+    _Station *stations;
+    TraceSection *sections;
+    short int tailmost_station_id;
+    short int nosemost_station_id;
+    TraceStats trace_stats[JOBS_MAX_WORKERS]; /* one per station worker */
+};
+
+static bool _oref_at_station(Oref *oref, float x) {
+    return x >= oref->object->min_x && x <= oref->object->max_x;
+}
+
+static bool _conn_at_station(Conn *c, float x) {
+    return x > c->tail_o->object->max_x && x < c->nose_o->object->min_x;
+}
+
+/* Counts pipes at a station so section shapes can be allocated, only writes to its own section. */
+static void _count_shapes_job(void *data, int station_i, int) {
+    _TraceJobs *jobs = (_TraceJobs *)data;
+    Fuselage *fuselage = jobs->fuselage;
+    float x = jobs->stations[station_i].x;
+    int count = 0;
+
+    for (int i = 0; i < fuselage->orefs_count; ++i)
+        if (_oref_at_station(fuselage->orefs + i, x))
+            ++count;
+    for (int i = 0; i < fuselage->conns_count; ++i)
+        if (_conn_at_station(fuselage->conns + i, x))
+            ++count;
+
+    jobs->sections[station_i].shapes_count = count;
+}
+
+/* Intersects all pipes (objects and connections) at a station, only writes to its own section. */
+static void _section_shapes_job(void *data, int station_i, int) {
+    _TraceJobs *jobs = (_TraceJobs *)data;
+    Fuselage *fuselage = jobs->fuselage;
+    _Station *station = jobs->stations + station_i;
+    TraceSection *sect = jobs->sections + station_i;
+    int max_shapes_count = sect->shapes_count; /* counted before shapes were allocated */
+    sect->t_env = 0;
+    sect->n_env = 0;
+    sect->x = station->x;
+    sect->shapes_count = 0;
+    sect->t_shapes_count = 0;
+    sect->n_shapes_count = 0;
+    sect->two_envelopes = false;
+    sect->wisecs_count = 0;
+
+    /* intersect objects */
+
+    for (int i = 0; i < fuselage->orefs_count; ++i) {
+        Oref *oref = fuselage->orefs + i;
+
+        if (_oref_at_station(oref, station->x)) {
+            assert(sect->shapes_count < max_shapes_count);
+            Shape *s = sect->shapes + sect->shapes_count++;
+
+            bool is_t_opening = station->id != jobs->tailmost_station_id && station->id == oref->t_station.id;
+            bool is_n_opening = station->id != jobs->nosemost_station_id && station->id == oref->n_station.id;
+
+            _get_section_shape(jobs->worker->settings, station->x, s,
+                               &oref->t_skin_former, oref->t_tangents, false,
+                               &oref->n_skin_former, oref->n_tangents, false);
+
+            s->ids.tail = oref->id;
+            s->ids.nose = oref->id;
+            if (!is_t_opening)
+                sect->t_shapes[sect->t_shapes_count++] = s;
+            if (!is_n_opening)
+                sect->n_shapes[sect->n_shapes_count++] = s;
+            if (is_t_opening || is_n_opening)
+                sect->two_envelopes = true;
+        }
+    }
+
+    /* intersect connections between objects */
+
+    for (int i = 0; i < fuselage->conns_count; ++i) {
+        Conn *c = fuselage->conns + i;
+        Oref *t_oref = c->tail_o;
+        Oref *n_oref = c->nose_o;
+
+        if (_conn_at_station(c, station->x)) {
+            assert(sect->shapes_count < max_shapes_count);
+            Shape *s = sect->shapes + sect->shapes_count++;
+
+            _get_section_shape(jobs->worker->settings, station->x, s,
+                               &t_oref->n_skin_former, t_oref->n_tangents, t_oref->n_conns_count > 1,
+                               &n_oref->t_skin_former, n_oref->t_tangents, n_oref->t_conns_count > 1);
+
+            s->ids.tail = t_oref->id;
+            s->ids.nose = n_oref->id;
+            sect->t_shapes[sect->t_shapes_count++] = s;
+            sect->n_shapes[sect->n_shapes_count++] = s;
+        }
+    }
+}
+
+/* Traces an envelope around shapes, or reuses the one traced for the same shapes in a recent loft. */
+static bool _trace_envelope(LoftWorker *worker, Arena *env_arena, TraceStats *stats, TraceEnv *env, Shape **shapes, int shapes_count) {
+    int curve_subdivs = worker->settings->shape_curve_samples;
+    bool exact = worker->settings->exact_tracing;
+    if (mesh_trace_cache_get(worker->cache, env, shapes, shapes_count, curve_subdivs, exact))
+        return true;
+
+    int retries;
+    bool success = mesh_trace_envelope(env_arena, env, shapes, shapes_count, curve_subdivs, exact, &retries);
+    ++stats->traced;
+    if (retries > 0)
+        ++stats->retried;
+    stats->retries += retries;
+
+    if (success)
+        mesh_trace_cache_put(worker->cache, env, shapes, shapes_count, curve_subdivs, exact);
+    else
+        ++stats->failed;
+    return success;
+}
+
+/* Traces envelopes of a section using station worker's own envelope arena. */
+static void _trace_job(void *data, int station_i, int worker_i) {
+    _TraceJobs *jobs = (_TraceJobs *)data;
+    LoftWorker *worker = jobs->worker;
+    Arena *env_arena = worker->env_arenas[worker_i];
+    TraceStats *stats = jobs->trace_stats + worker_i;
+    TraceSection *sect = jobs->sections + station_i;
+
+    if (sect->t_env == 0) /* no shapes on either side */
+        return;
+
+    bool success = _trace_envelope(worker, env_arena, stats, sect->t_env, sect->t_shapes, sect->t_shapes_count);
+    model_assert(worker->model, success, "envelope_trace_failed");
+
+    if (sect->two_envelopes) {
+        bool n_success = _trace_envelope(worker, env_arena, stats, sect->n_env, sect->n_shapes, sect->n_shapes_count);
+        model_assert(worker->model, n_success, "envelope_trace_failed");
+    }
+}
+
+static TraceEnv *_make_trace_env(Arena *arena, int shapes_count, int shape_subdivs, int max_wisecs) {
+    TraceEnv *env = arena->alloc<TraceEnv>();
+    env->count = 0;
+    env->max_count = MAX_TRACE_ENV_POINTS(shapes_count, shape_subdivs) + max_wisecs;
+    env->points = arena->alloc<EnvPoint>(env->max_count);
+    return env;
+}
+
 /* Fuselage section containing mesh envelopes. */
 struct MeshSection {
-    MeshEnv envs[2];                        /* actual storage */
-    MeshEnv *t_env, *n_env;                 /* aliases of the above, both point envs[0] most of the time */
-    int neighbors_map[MAX_ENVELOPE_POINTS]; /* maps tailwise envelope point indices to tailwise triangles */
+    MeshEnv envs[2];        /* actual storage */
+    MeshEnv *t_env, *n_env; /* aliases of the above, both point envs[0] most of the time */
+    int *neighbors_map;     /* maps tailwise envelope point indices to tailwise triangles */
+};
+
+static void _init_mesh_env(Arena *arena, MeshEnv *env, int max_count) {
+    env->points = arena->alloc<MeshPoint>(max_count);
+    env->slices = arena->alloc<MeshEnvSlice>(max_count);
+    env->max_count = max_count;
+    env->count = 0;
+    env->slices_count = 0;
+}
+
+/* Meshing is done in two stages: making mesh envelopes for a station (only writes skin
+vertices) and meshing between the station and the previous one (only writes skin panels).
+Stages keep their output separate and mesh envelope vertex bases are a running sum of
+vertex counts kept by the first stage, so both stages can run at the same time on a ring
+of mesh sections. */
+struct _MeshJobs {
+    LoftWorker *worker;
+    _Station *stations;
+    int stations_count;
+    TraceSection *trace_sections;
+    MeshSection *sections; /* ring */
+    int shape_subdivs;
+    int made_count;     /* stations with mesh envelopes made */
+    int meshed_count;   /* stations meshed to the previous station */
+    std::mutex mutex;   /* guards counts when stages are pipelined */
+    std::condition_variable count_cond; /* signalled when a stage advances its count */
 };
 
+/* Waits for the other stage to advance its count to at least value. */
+static void _wait_for_count(_MeshJobs *jobs, int *count, int value) {
+    std::unique_lock<std::mutex> lock(jobs->mutex);
+    while (*count < value)
+        jobs->count_cond.wait(lock);
+}
+
+static void _set_count(_MeshJobs *jobs, int *count, int value) {
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        *count = value;
+    }
+    jobs->count_cond.notify_one(); /* only the other stage can be waiting */
+}
+
+/* First stage, makes mesh envelopes from trace envelopes. */
+static void _make_mesh_section(_MeshJobs *jobs, int i) {
+    TraceSection *trace_section = jobs->trace_sections + i;
+    MeshSection *section = jobs->sections + i % _MESH_SECTIONS_RING;
+
+    if (trace_section->t_env == 0 && trace_section->n_env == 0)
+        return;
+
+    if (trace_section->two_envelopes) {
+        section->t_env = section->envs;
+        section->n_env = section->envs + 1;
+    }
+    else
+        section->t_env = section->n_env = section->envs;
+
+    mesh_make_envelopes(jobs->worker, jobs->stations[i].x,
+                        section->t_env, trace_section->t_env,
+                        section->n_env, trace_section->n_env);
+
+    if (i == 0)
+        for (int j = 0; j < section->n_env->count; ++j)
+            section->neighbors_map[j] = -1; /* there are no triangles tailwise of the tailmost section */
+}
+
+/* Second stage, meshes between the station and the previous one. */
+static void _mesh_sections(_MeshJobs *jobs, int i) {
+    TraceSection *n_trace_sect = jobs->trace_sections + i;
+
+    if (i == 0 || (n_trace_sect->t_env == 0 && n_trace_sect->n_env == 0))
+        return;
+
+    TraceSection *t_trace_sect = jobs->trace_sections + i - 1;
+    MeshSection *t_s = jobs->sections + (i - 1) % _MESH_SECTIONS_RING;
+    MeshSection *n_s = jobs->sections + i % _MESH_SECTIONS_RING;
+
+    mesh_apply_merge_filter(jobs->worker->arena, jobs->shape_subdivs,
+                            t_trace_sect->n_shapes, t_trace_sect->n_shapes_count, t_s->n_env,
+                            n_trace_sect->t_shapes, n_trace_sect->t_shapes_count, n_s->t_env);
+
+    mesh_between_two_sections(jobs->worker, jobs->shape_subdivs,
+                              t_s->n_env, t_s->neighbors_map,
+                              n_s->t_env, n_s->neighbors_map);
+}
+
+/* Runs one of the stages over all stations, waiting on the other stage when needed. */
+static void _mesh_stage_job(void *data, int stage_i, int) {
+    _MeshJobs *jobs = (_MeshJobs *)data;
+
+    if (stage_i == 0) {
+        for (int i = 0; i < jobs->stations_count; ++i) {
+            _wait_for_count(jobs, &jobs->meshed_count, i - _MESH_SECTIONS_RING + 2); /* section in ring still used by the second stage */
+            _make_mesh_section(jobs, i);
+            _set_count(jobs, &jobs->made_count, i + 1);
+        }
+    }
+    else {
+        for (int i = 0; i < jobs->stations_count; ++i) {
+            _wait_for_count(jobs, &jobs->made_count, i + 1); /* mesh envelopes not made yet */
+            _mesh_sections(jobs, i);
+            _set_count(jobs, &jobs->meshed_count, i + 1);
+        }
+    }
+}
+
 /* Main fuselage lofting function. Generates fuselage skin panels. */
-void fuselage_loft(Arena *arena, Arena *verts_arena,
-                   Model *model, Fuselage *fuselage) {
+void fuselage_loft(LoftWorker *worker, Fuselage *fuselage) {
+    Arena *arena = worker->arena;
 
-    int shape_subdivs = SHAPE_CURVE_SAMPLES * SHAPE_CURVES;
+    int shape_subdivs = worker->settings->shape_curve_samples * SHAPE_CURVES;
 
     /* assign fuselage elements' ids */
 
@@ -156,7 +416,8 @@ void fuselage_loft(Arena *arena, Arena *verts_arena,
 
     /* get required stations */
 
-    _Station *req_stations = arena->alloc<_Station>(MAX_ELEM_REFS * 2);
+    int max_req_stations = (fuselage->orefs_count + fuselage->wrefs_count) * 2;
+    _Station *req_stations = arena->alloc<_Station>(max_req_stations);
     int req_stations_count = 0;
 
     {
@@ -182,7 +443,7 @@ void fuselage_loft(Arena *arena, Arena *verts_arena,
         for (int i = 0; i < fuselage->wrefs_count; ++i) {
             Wref *wref = fuselage->wrefs + i;
 
-            static float x_positions[MAX_ELEM_REFS];
+            float x_positions[MAX_ELEM_REFS];
             int count = wing_get_required_stations(wref->wing, x_positions);
 
             wref->t_station.id = _insert_station(req_stations,
@@ -224,13 +485,17 @@ void fuselage_loft(Arena *arena, Arena *verts_arena,
     /* once we have required stations we can create actual stations by copying required
     ones and inserting additional stations wrt calculated mesh size */
 
-    _Station *stations = arena->alloc<_Station>(_MAX_FUSELAGE_STATIONS);
+    int max_stations = req_stations_count;
+    for (int i = 1; i < req_stations_count; ++i)
+        max_stations += (int)floorf((req_stations[i].x - req_stations[i - 1].x) / mesh_size);
+
+    _Station *stations = arena->alloc<_Station>(max_stations);
     int stations_count = 0;
     short int tailmost_station_id;
     short int nosemost_station_id;
 
     {
-        short int *id_to_index = arena->alloc<short int>(MAX_ELEM_REFS * 2); /* maps stations id to index */
+        short int *id_to_index = arena->alloc<short int>(max_req_stations); /* maps stations id to index */
 
         /* copy first required station */
 
@@ -249,7 +514,7 @@ void fuselage_loft(Arena *arena, Arena *verts_arena,
             float dx = d / (count + 1);
 
             for (int j = 0; j < count; ++j) {
-                assert(stations_count < _MAX_FUSELAGE_STATIONS);
+                assert(stations_count < max_stations);
                 _init_station(stations + stations_count++,
                               s1->x + (j + 1) * dx,
                               available_station_id++);
@@ -287,81 +552,61 @@ void fuselage_loft(Arena *arena, Arena *verts_arena,
 
     TraceSection *trace_sections = arena->alloc<TraceSection>(stations_count);
 
-    for (int i = 0; i < stations_count; ++i) {
-        _Station *station = stations + i;
-        TraceSection *sect = trace_sections + i;
-        sect->t_env = 0;
-        sect->n_env = 0;
-        sect->x = station->x;
-        sect->shapes_count = 0;
-        sect->t_shapes_count = 0;
-        sect->n_shapes_count = 0;
-        sect->two_envelopes = false;
-        sect->wisecs_count = 0;
+    _TraceJobs trace_jobs;
+    trace_jobs.worker = worker;
+    trace_jobs.fuselage = fuselage;
+    trace_jobs.stations = stations;
+    trace_jobs.sections = trace_sections;
+    trace_jobs.tailmost_station_id = tailmost_station_id;
+    trace_jobs.nosemost_station_id = nosemost_station_id;
+    memset(trace_jobs.trace_stats, 0, sizeof(trace_jobs.trace_stats));
 
-        /* intersect objects */
+    jobs_run(worker->station_jobs, _count_shapes_job, &trace_jobs, stations_count, worker->station_workers_count);
 
-        for (int i = 0; i < fuselage->orefs_count; ++i) {
-            Oref *oref = fuselage->orefs + i;
+    int max_wisecs = MAX_WING_ISECS_PER_STATION(fuselage->wrefs_count);
 
-            if (station->x >= oref->object->min_x && station->x <= oref->object->max_x) {
-                assert(sect->shapes_count < MAX_ENVELOPE_SHAPES);
-                Shape *s = sect->shapes + sect->shapes_count++;
-
-                bool is_t_opening = station->id != tailmost_station_id && station->id == oref->t_station.id;
-                bool is_n_opening = station->id != nosemost_station_id && station->id == oref->n_station.id;
-
-                _get_section_shape(station->x, s,
-                                   &oref->t_skin_former, oref->t_tangents, false,
-                                   &oref->n_skin_former, oref->n_tangents, false);
-
-                s->ids.tail = oref->id;
-                s->ids.nose = oref->id;
-                if (!is_t_opening)
-                    sect->t_shapes[sect->t_shapes_count++] = s;
-                if (!is_n_opening)
-                    sect->n_shapes[sect->n_shapes_count++] = s;
-                if (is_t_opening || is_n_opening)
-                    sect->two_envelopes = true;
-            }
+    {
+        int shapes_count = 0;
+        for (int i = 0; i < stations_count; ++i)
+            shapes_count += trace_sections[i].shapes_count;
+
+        Shape *shapes = arena->alloc<Shape>(shapes_count);
+        Shape **aliases = arena->alloc<Shape *>(shapes_count * 2);
+        Wisec *wisecs = arena->alloc<Wisec>(stations_count * max_wisecs);
+
+        for (int i = 0; i < stations_count; ++i) {
+            TraceSection *sect = trace_sections + i;
+            sect->shapes = shapes;
+            sect->t_shapes = aliases;
+            sect->n_shapes = aliases + sect->shapes_count;
+            sect->wisecs = wisecs + i * max_wisecs;
+            shapes += sect->shapes_count;
+            aliases += sect->shapes_count * 2;
         }
+    }
 
-        /* intersect connections between objects */
-
-        for (int i = 0; i < fuselage->conns_count; ++i) {
-            Conn *c = fuselage->conns + i;
-            Oref *t_oref = c->tail_o;
-            Oref *n_oref = c->nose_o;
-
-            if (station->x > t_oref->object->max_x && station->x < n_oref->object->min_x) {
-                assert(sect->shapes_count < MAX_ENVELOPE_SHAPES);
-                Shape *s = sect->shapes + sect->shapes_count++;
-
-                _get_section_shape(station->x, s,
-                                   &t_oref->n_skin_former, t_oref->n_tangents, t_oref->n_conns_count > 1,
-                                   &n_oref->t_skin_former, n_oref->t_tangents, n_oref->t_conns_count > 1);
+    jobs_run(worker->station_jobs, _section_shapes_job, &trace_jobs, stations_count, worker->station_workers_count);
 
-                s->ids.tail = t_oref->id;
-                s->ids.nose = n_oref->id;
-                sect->t_shapes[sect->t_shapes_count++] = s;
-                sect->n_shapes[sect->n_shapes_count++] = s;
-            }
-        }
+    for (int i = 0; i < stations_count; ++i) {
+        TraceSection *sect = trace_sections + i;
 
         if (sect->t_shapes_count == 0 || sect->n_shapes_count == 0) /* skip if there are no shapes on either side */
             continue;
 
-        /* trace envelopes */
+        /* wing intersections are only inserted into tailwise envelopes */
+        sect->t_env = sect->n_env = _make_trace_env(arena, sect->t_shapes_count, shape_subdivs, max_wisecs);
+        if (sect->two_envelopes)
+            sect->n_env = _make_trace_env(arena, sect->n_shapes_count, shape_subdivs, 0);
+    }
 
-        sect->t_env = sect->n_env = arena->alloc<TraceEnv>();
-        bool success = mesh_trace_envelope(sect->t_env, sect->t_shapes, sect->t_shapes_count, SHAPE_CURVE_SAMPLES);
-        model_assert(model, success, "envelope_trace_failed");
+    jobs_run(worker->station_jobs, _trace_job, &trace_jobs, stations_count, worker->station_workers_count);
 
-        if (sect->two_envelopes) {
-            sect->n_env = arena->alloc<TraceEnv>();
-            bool n_success = mesh_trace_envelope(sect->n_env, sect->n_shapes, sect->n_shapes_count, SHAPE_CURVE_SAMPLES);
-            model_assert(model, n_success, "envelope_trace_failed");
-        }
+    for (int i = 0; i < worker->station_workers_count; ++i) {
+        TraceStats *s = trace_jobs.trace_stats + i;
+        worker->trace_stats.traced += s->traced;
+        worker->trace_stats.retried += s->retried;
+        worker->trace_stats.retries += s->retries;
+        worker->trace_stats.failed += s->failed;
     }
 
     /* wing intersections */
@@ -370,51 +615,42 @@ void fuselage_loft(Arena *arena, Arena *verts_arena,
                                      fuselage->wrefs, fuselage->wrefs_count,
                                      trace_sections, stations_count);
 
-    /* mesh between each two neighboring sections */
-
-    MeshSection *sections[2];
-    sections[0] = arena->alloc<MeshSection>();
-    sections[1] = arena->alloc<MeshSection>();
+    /* mesh between each two neighboring sections, mesh envelopes get points from both trace
+    envelopes of a section */
 
+    int max_mesh_points = 0;
     for (int i = 0; i < stations_count; ++i) {
-        _Station *station = stations + i;
-        MeshSection *section = sections[i % 2];
-        TraceSection *trace_section = trace_sections + i;
-
-        if (trace_section->t_env == 0 && trace_section->n_env == 0)
+        TraceSection *sect = trace_sections + i;
+        if (sect->t_env == 0)
             continue;
+        int count = sect->t_env->count;
+        if (sect->two_envelopes)
+            count += sect->n_env->count;
+        if (count > max_mesh_points)
+            max_mesh_points = count;
+    }
 
-        if (trace_section->two_envelopes) {
-            section->t_env = section->envs;
-            section->n_env = section->envs + 1;
-        }
-        else
-            section->t_env = section->n_env = section->envs;
-
-        /* make mesh envelopes from trace envelopes */
-
-        mesh_make_envelopes(model, verts_arena, station->x,
-                            section->t_env, trace_section->t_env,
-                            section->n_env, trace_section->n_env);
-
-        /* mesh */
-
-        if (i == 0)
-            for (int j = 0; j < section->n_env->count; ++j)
-                section->neighbors_map[j] = -1; /* there are no triangles tailwise of the tailmost section */
-        else {
-            MeshSection *t_s = sections[(section == sections[0]) ? 1 : 0];
-            MeshSection *n_s = section;
-            TraceSection *t_trace_sect = trace_sections + i - 1;
-            TraceSection *n_trace_sect = trace_sections + i;
-
-            mesh_apply_merge_filter(arena, shape_subdivs,
-                                    t_trace_sect->n_shapes, t_trace_sect->n_shapes_count, t_s->n_env,
-                                    n_trace_sect->t_shapes, n_trace_sect->t_shapes_count, n_s->t_env);
-
-            mesh_between_two_sections(model, shape_subdivs,
-                                      t_s->n_env, t_s->neighbors_map,
-                                      n_s->t_env, n_s->neighbors_map);
-        }
+    _MeshJobs mesh_jobs;
+    mesh_jobs.worker = worker;
+    mesh_jobs.stations = stations;
+    mesh_jobs.stations_count = stations_count;
+    mesh_jobs.trace_sections = trace_sections;
+    mesh_jobs.sections = arena->alloc<MeshSection>(_MESH_SECTIONS_RING);
+    for (int i = 0; i < _MESH_SECTIONS_RING; ++i) {
+        MeshSection *section = mesh_jobs.sections + i;
+        _init_mesh_env(arena, section->envs, max_mesh_points);
+        _init_mesh_env(arena, section->envs + 1, max_mesh_points);
+        section->neighbors_map = arena->alloc<int>(max_mesh_points);
     }
+    mesh_jobs.shape_subdivs = shape_subdivs;
+    mesh_jobs.made_count = 0;
+    mesh_jobs.meshed_count = 0;
+
+    if (worker->station_workers_count > 1) /* pipelined */
+        jobs_run(worker->station_jobs, _mesh_stage_job, &mesh_jobs, 2, 2);
+    else
+        for (int i = 0; i < stations_count; ++i) {
+            _make_mesh_section(&mesh_jobs, i);
+            _mesh_sections(&mesh_jobs, i);
+        }
 }
@@ -10,13 +10,11 @@
 #include <assert.h>
 
 
-static Arena mesh_arena(50000000);
-
 #if DRAW_CORRS
 #include "math_vec.h"
 
-static Arena corr_verts_arena(1000000);
-static Arena corr_colors_arena(1000000);
+static Arena corr_verts_arena(1000000, ARENA_CONTIGUOUS, "corr verts");
+static Arena corr_colors_arena(1000000, ARENA_CONTIGUOUS, "corr colors");
 static Model *ctx_model;
 static float ctx_x1, ctx_x2;
 
@@ -44,25 +42,21 @@ void _draw_corr(MeshPoint *t_p, MeshPoint *n_p, float r, float g, float b) {
     c->g = g;
     c->b = b;
     ++ctx_model->corrs_count;
+    ctx_model->corr_verts = corr_verts_arena.base<vec3>(); /* arenas may have moved while growing */
+    ctx_model->corr_colors = corr_colors_arena.base<vec3>();
 }
 
-#endif
-
-/* Initialize. */
+/* Initialize. Only resets debug correlation drawing, which requires lofting with a single worker. */
 void mesh_init(Model *model) {
-    mesh_arena.clear();
-    model->panels = mesh_arena.rest<Panel>();
-    model->panels_count = 0;
-
-#if DRAW_CORRS
     corr_verts_arena.clear();
     corr_colors_arena.clear();
     model->corr_verts = corr_verts_arena.rest<vec3>();
     model->corr_colors = corr_colors_arena.rest<vec3>();
     model->corrs_count = 0;
-#endif
 }
 
+#endif
+
 // TODO: maybe bundle this somewhere with Origin
 static bool _origins_related(Ids t_ids, Ids n_ids) {
     if (t_ids.nose == n_ids.tail) /* two shapes of the same object, one object and one connection shape */
@@ -73,7 +67,7 @@ static bool _origins_related(Ids t_ids, Ids n_ids) {
 }
 
 /* Add a single skin panel and connect neighbors. */
-static void _add_skin_panel(Model *m,
+static void _add_skin_panel(LoftWorker *w,
                             int prev_t_env_i, int next_t_env_i, MeshEnv *t_env, int *t_neighbors_map,
                             int prev_n_env_i, int next_n_env_i, MeshEnv *n_env, int *n_neighbors_map) {
 
@@ -82,7 +76,7 @@ static void _add_skin_panel(Model *m,
 
     /* set panel vertices */
 
-    Panel *p = mesh_arena.alloc<Panel>(1);
+    Panel *p = w->mesh_arena->alloc<Panel>(1);
     if (next_t_env_i == -1) {       /* tailwise triangle */
         int n_i2 = n_env->points[next_n_env_i].vert_i;
         p->v1 = t_i1 + t_env->verts_base_i;
@@ -108,20 +102,21 @@ static void _add_skin_panel(Model *m,
 
     /* set panel neighbors */
 
-    // p->prev = m->panels_count - 1;
-    // p->next = m->panels_count + 1;
+    p->prev = p->next = p->tail = p->nose = -1;
+    // p->prev = w->panels_count - 1;
+    // p->next = w->panels_count + 1;
     // p->tail = (next_t_env_i != -1) ? t_neighbors_map[t_i1] : -1;    /* set tailwise neighbor if this panel can have it (quad or nosewise triangle) */
     // p->nose = -1;                                                   /* nosewise neighbor will (maybe) be set in future */
     // if (p->tail != -1)                                              /* if this panel has a tailwise neighbor */
-    //     m->panels[p->tail].nose = m->panels_count;                  /* set it as its nosewise neighbor (set back-reference) */
+    //     w->panels[p->tail].nose = w->panels_count;                  /* set it as its nosewise neighbor (set back-reference) */
     // if (next_n_env_i != -1)                                         /* if this panel can be a tailwise neighbor (quad or tailwise triangle) */
-    //     n_neighbors_map[n_i1] = m->panels_count;                    /* remember it as tailwise panel to something in future */
+    //     n_neighbors_map[n_i1] = w->panels_count;                    /* remember it as tailwise panel to something in future */
 
-    ++m->panels_count;
+    ++w->panels_count;
 }
 
 /* Returns early or subdivides points into two sides wrt normalized positions and recurses on both sides. */
-static void _mesh_pass_5(Model *model,
+static void _mesh_pass_5(LoftWorker *worker,
                          int t_beg, int t_end, double *t_params, MeshEnv *t_env, int *t_neighbors_map,
                          int n_beg, int n_end, double *n_params, MeshEnv *n_env, int *n_neighbors_map) {
 
@@ -134,7 +129,7 @@ static void _mesh_pass_5(Model *model,
 
         // TODO: think about splitting this into two triangles if angle between two quad sides is too large
 
-        _add_skin_panel(model,
+        _add_skin_panel(worker,
                         t_beg, t_end, t_env, t_neighbors_map,
                         n_beg, n_end, n_env, n_neighbors_map);
         return;
@@ -143,7 +138,7 @@ static void _mesh_pass_5(Model *model,
         int i1 = t_beg;
         int i2 = period_incr(t_beg, t_env->count);
         while (i1 != t_end) {
-            _add_skin_panel(model,
+            _add_skin_panel(worker,
                             i1,    i2, t_env, t_neighbors_map,
                             n_beg, -1, n_env, n_neighbors_map);
             i1 = i2;
@@ -155,7 +150,7 @@ static void _mesh_pass_5(Model *model,
         int i1 = n_beg;
         int i2 = period_incr(n_beg, n_env->count);
         while (i1 != n_end) {
-            _add_skin_panel(model,
+            _add_skin_panel(worker,
                             t_beg, -1, t_env, t_neighbors_map,
                             i1,    i2, n_env, n_neighbors_map);
             i1 = i2;
@@ -187,14 +182,14 @@ static void _mesh_pass_5(Model *model,
     if (t_min == -1)
         return;
 
-    model_assert(model, t_min != -1, "cannot_find_divider_in_mesh_pass_5");
+    model_assert(worker->model, t_min != -1, "cannot_find_divider_in_mesh_pass_5");
 
     /* mesh both resulting sides */
 
-    _mesh_pass_5(model,
+    _mesh_pass_5(worker,
                  t_beg, t_min, t_params, t_env, t_neighbors_map,
                  n_beg, n_min, n_params, n_env, n_neighbors_map);
-    _mesh_pass_5(model,
+    _mesh_pass_5(worker,
                  t_min, t_end, t_params, t_env, t_neighbors_map,
                  n_min, n_end, n_params, n_env, n_neighbors_map);
 }
@@ -221,11 +216,11 @@ static void _normalized_positions(MeshPoint *env_points, int env_count, int beg,
 }
 
 /* Handles non-intersections merging into intersection edges. */
-static void _mesh_pass_4(Model *model,
+static void _mesh_pass_4(LoftWorker *worker,
                          int t_beg, int t_end, MeshEnv *t_env, int *t_neighbors_map,
                          int n_beg, int n_end, MeshEnv *n_env, int *n_neighbors_map) {
-    static double t_params[MAX_ENVELOPE_POINTS];
-    static double n_params[MAX_ENVELOPE_POINTS];
+    double *t_params = worker->arena->lock<double>(t_env->count);
+    double *n_params = worker->arena->lock<double>(n_env->count);
     _normalized_positions(t_env->points, t_env->count, t_beg, t_end, t_params);
     _normalized_positions(n_env->points, n_env->count, n_beg, n_end, n_params);
 
@@ -237,7 +232,7 @@ static void _mesh_pass_4(Model *model,
     MeshPoint *n_beg_p = n_env->points + n_beg;
     MeshPoint *n_end_p = n_env->points + n_end;
 
-    int shape_subdivs = SHAPE_CURVE_SAMPLES * SHAPE_CURVES;
+    int shape_subdivs = worker->settings->shape_curve_samples * SHAPE_CURVES;
 
     if (t_beg_p->is_intersection && n_beg_p->is_intersection) { /* beg edge is intersection */
         int isec_diff = period_diff(n_beg_p->i2, t_beg_p->i2, shape_subdivs);
@@ -248,7 +243,7 @@ static void _mesh_pass_4(Model *model,
                 MeshPoint *t_p = t_env->points + t_i;
 
                 while (t_i != t_end && period_diff(n_beg_p->i2, t_p->i1, shape_subdivs) >= 0) {
-                    _add_skin_panel(model,
+                    _add_skin_panel(worker,
                                     t_beg, t_i, t_env, t_neighbors_map,
                                     n_beg,  -1, n_env, n_neighbors_map);
                     t_beg = t_i;
@@ -263,7 +258,7 @@ static void _mesh_pass_4(Model *model,
                 MeshPoint *n_p = n_env->points + n_i;
 
                 while (n_i != n_end && period_diff(t_beg_p->i2, n_p->i1, shape_subdivs) >= 0) {
-                    _add_skin_panel(model,
+                    _add_skin_panel(worker,
                                     t_beg,  -1, t_env, t_neighbors_map,
                                     n_beg, n_i, n_env, n_neighbors_map);
                     n_beg = n_i;
@@ -283,7 +278,7 @@ static void _mesh_pass_4(Model *model,
                 MeshPoint *n_p = n_env->points + n_i;
 
                 while (n_i != n_beg && period_diff(n_p->i2, t_end_p->i1, shape_subdivs) >= 0) {
-                    _add_skin_panel(model,
+                    _add_skin_panel(worker,
                                     t_end,  -1, t_env, t_neighbors_map,
                                     n_i, n_end, n_env, n_neighbors_map);
                     n_end = n_i;
@@ -298,7 +293,7 @@ static void _mesh_pass_4(Model *model,
                 MeshPoint *t_p = t_env->points + t_i;
 
                 while (t_i != t_beg && period_diff(t_p->i2, n_end_p->i1, shape_subdivs) >= 0) {
-                    _add_skin_panel(model,
+                    _add_skin_panel(worker,
                                     t_i, t_end, t_env, t_neighbors_map,
                                     n_end,  -1, n_env, n_neighbors_map);
                     t_end = t_i;
@@ -309,9 +304,12 @@ static void _mesh_pass_4(Model *model,
         }
     }
 
-    _mesh_pass_5(model,
+    _mesh_pass_5(worker,
                  t_beg, t_end, t_params, t_env, t_neighbors_map,
                  n_beg, n_end, n_params, n_env, n_neighbors_map);
+
+    worker->arena->unlock();
+    worker->arena->unlock();
 }
 
 /* Additional intersection info used for intersection correlation. */
@@ -321,7 +319,7 @@ struct _Isec {
 };
 
 /* Handles intersection merges (two-to-one intersection correlations). */
-static void _mesh_pass_3(Model *model,
+static void _mesh_pass_3(LoftWorker *worker,
                          int t_beg, int t_end, MeshEnv *t_env, int *t_neighbors_map,
                          int n_beg, int n_end, MeshEnv *n_env, int *n_neighbors_map,
                          _Isec *t_isecs, int t_beg_isec, int t_end_isec,
@@ -342,13 +340,13 @@ static void _mesh_pass_3(Model *model,
             _origins_related(t_isec->next_o, n_isec2->next_o) &&
             _origins_related(n_isec1->next_o, n_isec2->prev_o)) {
 
-            _mesh_pass_4(model,
+            _mesh_pass_4(worker,
                          t_beg, t_isec->env_i, t_env, t_neighbors_map,
                          n_beg, n_isec1->env_i, n_env, n_neighbors_map);
-            _mesh_pass_4(model,
+            _mesh_pass_4(worker,
                          t_isec->env_i, t_isec->env_i, t_env, t_neighbors_map,
                          n_isec1->env_i, n_isec2->env_i, n_env, n_neighbors_map);
-            _mesh_pass_4(model,
+            _mesh_pass_4(worker,
                          t_isec->env_i, t_end, t_env, t_neighbors_map,
                          n_isec2->env_i, n_end, n_env, n_neighbors_map);
 
@@ -369,13 +367,13 @@ static void _mesh_pass_3(Model *model,
             _origins_related(n_isec->next_o, t_isec2->next_o) &&
             _origins_related(t_isec1->next_o, t_isec2->prev_o)) {
 
-            _mesh_pass_4(model,
+            _mesh_pass_4(worker,
                          t_beg, t_isec1->env_i, t_env, t_neighbors_map,
                          n_beg, n_isec->env_i, n_env, n_neighbors_map);
-            _mesh_pass_4(model,
+            _mesh_pass_4(worker,
                          t_isec1->env_i, t_isec2->env_i, t_env, t_neighbors_map,
                          n_isec->env_i, n_isec->env_i, n_env, n_neighbors_map);
-            _mesh_pass_4(model,
+            _mesh_pass_4(worker,
                          t_isec2->env_i, t_end, t_env, t_neighbors_map,
                          n_isec->env_i, n_end, n_env, n_neighbors_map);
 
@@ -389,19 +387,19 @@ static void _mesh_pass_3(Model *model,
     }
 
     if (!merge_found) /* no intersection merge found, proceed to next pass */
-        _mesh_pass_4(model,
+        _mesh_pass_4(worker,
                      t_beg, t_end, t_env, t_neighbors_map,
                      n_beg, n_end, n_env, n_neighbors_map);
 }
 
 /* One-to-one correlate intersections and continue meshing in between. */
-static void _mesh_pass_2(Model *model,
+static void _mesh_pass_2(LoftWorker *worker,
                          MeshEnv *t_env, int prev_t_i, int last_t_i, int *t_neighbors_map,
                          MeshEnv *n_env, int prev_n_i, int last_n_i, int *n_neighbors_map)  {
     Ids t_prev_o = t_env->points[prev_t_i].ids;
     Ids n_prev_o = n_env->points[prev_n_i].ids;
 
-    static _Isec t_isecs[MAX_ENVELOPE_POINTS]; /* envelope indices */
+    _Isec *t_isecs = worker->arena->lock<_Isec>(t_env->count); /* envelope indices */
     int t_isecs_count = 0;
 
     for (int t_i = period_incr(prev_t_i, t_env->count); t_i != last_t_i; t_i = period_incr(t_i, t_env->count))
@@ -412,7 +410,7 @@ static void _mesh_pass_2(Model *model,
             isec->next_o = t_prev_o = t_env->points[t_i].ids;
         }
 
-    static _Isec n_isecs[MAX_ENVELOPE_POINTS]; /* envelope indices */
+    _Isec *n_isecs = worker->arena->lock<_Isec>(n_env->count); /* envelope indices */
     int n_isecs_count = 0;
 
     for (int n_i = period_incr(prev_n_i, n_env->count); n_i != last_n_i; n_i = period_incr(n_i, n_env->count))
@@ -437,7 +435,7 @@ static void _mesh_pass_2(Model *model,
             if (_origins_related(t_isec->prev_o, n_isec->prev_o) &&
                 _origins_related(t_isec->next_o, n_isec->next_o)) {
 
-                _mesh_pass_3(model,
+                _mesh_pass_3(worker,
                              prev_t_i, t_i, t_env, t_neighbors_map,
                              prev_n_i, n_i, n_env, n_neighbors_map,
                              t_isecs, prev_t_j, t_j,
@@ -458,26 +456,29 @@ static void _mesh_pass_2(Model *model,
 
     /* check if there were some interesting intersections stuck between the last correlated ones */
 
-    _mesh_pass_3(model,
+    _mesh_pass_3(worker,
                  prev_t_i, last_t_i, t_env, t_neighbors_map,
                  prev_n_i, last_n_i, n_env, n_neighbors_map,
                  t_isecs, prev_t_j, t_isecs_count,
                  n_isecs, prev_n_j, n_isecs_count);
+
+    worker->arena->unlock();
+    worker->arena->unlock();
 }
 
 /* Non-intersection point correlation struct. */
-static struct _Corr {
+struct _Corr {
     int t_env_i;
     int n_env_i;
-} *corrs = 0;
+};
 
 /* Make simple correlations between non-intersection points. */
-static void _mesh_pass_1(Model *model, int shape_subdivs,
+static void _mesh_pass_1(LoftWorker *worker, int shape_subdivs,
                          MeshEnv *t_env, int *t_neighbors_map,
                          MeshEnv *n_env, int *n_neighbors_map) {
 
-    if (corrs == 0)
-        corrs = (_Corr *)malloc(sizeof(_Corr) * MAX_ENVELOPE_POINTS);
+    int max_corrs = t_env->count + n_env->count;
+    _Corr *corrs = worker->arena->lock<_Corr>(max_corrs);
     int corrs_count = 0;
 
     /* make non-intersection point correlations */
@@ -494,7 +495,7 @@ static void _mesh_pass_1(Model *model, int shape_subdivs,
             int n_poly_beg = n_env->points[n_slice->beg].subdiv_i;
             int n_poly_end = n_env->points[n_slice->end].subdiv_i;
 
-            for (int l = 0; l < MAX_ENVELOPE_POINTS; ++l) {
+            for (int l = 0; l < t_env->count; ++l) {
                 int t_env_i = (t_slice->beg + l) % t_env->count;
                 MeshPoint *t_p = t_env->points + t_env_i;
 
@@ -507,6 +508,7 @@ static void _mesh_pass_1(Model *model, int shape_subdivs,
                         MeshPoint *n_p = n_env->points + n_env_i;
 
                         if (n_p->t_is_outermost) {
+                            assert(corrs_count < max_corrs);
 
                             int insert_i = 0;
                             for (; insert_i < corrs_count; ++insert_i) // TODO: maybe think about starting search from end
@@ -546,7 +548,7 @@ static void _mesh_pass_1(Model *model, int shape_subdivs,
         if (t_count == 1 && n_count == 1)           /* overlapping correlations, should not happen */
             fprintf(stderr, "overlapping correlations at section\n");
         else if (t_count == 2 && n_count == 2)      /* exactly one quad between the two correlations */
-            _add_skin_panel(model,
+            _add_skin_panel(worker,
                             prev_corr.t_env_i, curr_corr.t_env_i, t_env, t_neighbors_map,
                             prev_corr.n_env_i, curr_corr.n_env_i, n_env, n_neighbors_map);
         else if (t_count == 1) {                    /* tailwise triangles fan */
@@ -555,7 +557,7 @@ static void _mesh_pass_1(Model *model, int shape_subdivs,
             for (int k = 0; k < trias_count; ++k) {
                 int n_env_i1 = (prev_corr.n_env_i + k) % n_env->count;
                 int n_env_i2 = (n_env_i1 + 1) % n_env->count;
-                _add_skin_panel(model,
+                _add_skin_panel(worker,
                                 t_env_i,        -1, t_env, t_neighbors_map,
                                 n_env_i1, n_env_i2, n_env, n_neighbors_map);
             }
@@ -566,22 +568,24 @@ static void _mesh_pass_1(Model *model, int shape_subdivs,
             for (int k = 0; k < trias_count; ++k) {
                 int t_env_i1 = (prev_corr.t_env_i + k) % t_env->count;
                 int t_env_i2 = (t_env_i1 + 1) % t_env->count;
-                _add_skin_panel(model,
+                _add_skin_panel(worker,
                                 t_env_i1, t_env_i2, t_env, t_neighbors_map,
                                 n_env_i,        -1, n_env, n_neighbors_map);
             }
         }
         else                                        /* multiple vertices between correlations */
-            _mesh_pass_2(model,
+            _mesh_pass_2(worker,
                          t_env, prev_corr.t_env_i, curr_corr.t_env_i, t_neighbors_map,
                          n_env, prev_corr.n_env_i, curr_corr.n_env_i, n_neighbors_map);
 
         prev_corr = curr_corr;
     }
+
+    worker->arena->unlock();
 }
 
 /* Handles simplest case when all the points can be correlated directly, one-to-one. */
-static void _mesh_pass_0(Model *model, int shape_subdivs,
+static void _mesh_pass_0(LoftWorker *worker, int shape_subdivs,
                          MeshEnv *t_env, int *t_neighbors_map,
                          MeshEnv *n_env, int *n_neighbors_map) {
     int t_i1 = 0;
@@ -597,7 +601,7 @@ static void _mesh_pass_0(Model *model, int shape_subdivs,
     int n_i2 = period_incr(n_i1, n_env->count);
 
     for (int j = 0; j < shape_subdivs; ++j) {
-        _add_skin_panel(model,
+        _add_skin_panel(worker,
                         t_i1, t_i2, t_env, t_neighbors_map,
                         n_i1, n_i2, n_env, n_neighbors_map);
         t_i1 = t_i2;
@@ -608,28 +612,29 @@ static void _mesh_pass_0(Model *model, int shape_subdivs,
 }
 
 /* Main meshing procedure. */
-void mesh_between_two_sections(Model *model, int shape_subdivs,
+void mesh_between_two_sections(LoftWorker *worker, int shape_subdivs,
                                MeshEnv *t_env, int *t_neighbors_map,
                                MeshEnv *n_env, int *n_neighbors_map) {
 
 #if DRAW_CORRS
-    _init_corr(model, t_env->x, n_env->x);
+    _init_corr(worker->model, t_env->x, n_env->x);
 #endif
 
-    int first_panel_i = model->panels_count;
+    int first_panel_i = worker->panels_count;
 
     if (t_env->slices_count == 1 && t_env->count == shape_subdivs &&
         n_env->slices_count == 1 && n_env->count == shape_subdivs)  /* simple case when both sections contain only one shape */
-        _mesh_pass_0(model, shape_subdivs,
+        _mesh_pass_0(worker, shape_subdivs,
                      t_env, t_neighbors_map,
                      n_env, n_neighbors_map);
     else                                                            /* more complicated case where we don't have clear correlations between all points */
-        _mesh_pass_1(model, shape_subdivs,
+        _mesh_pass_1(worker, shape_subdivs,
                      t_env, t_neighbors_map,
                      n_env, n_neighbors_map);
 
     /* fix first and last panels neighbors */
 
-    model->panels[first_panel_i].prev = model->panels_count - 1;
-    model->panels[model->panels_count - 1].next = first_panel_i;
+    Panel *panels = worker->mesh_arena->base<Panel>();
+    panels[first_panel_i].prev = worker->panels_count - 1;
+    panels[worker->panels_count - 1].next = first_panel_i;
 }
@@ -16,10 +16,11 @@
 #define PARALLEL_MARGIN         1.0e-10 /* updates, old to new: 1.0e-5 */
 #define MIN_WEIGHT_RATIO        0.9
 #define MAX_WEIGHT_RATIO        (1.0 / MIN_WEIGHT_RATIO)
+#define _MAX_GRID_DIM           32
+#define _GRID_MIN_POLYS         4 /* fewer polygons are quicker to test through their quadrant bounds */
+#define _EXACT_BITS             23 /* snapped coordinates stay below 2^23, so orientations of snapped points are exact */
 
 
-static Arena env_arena(200000);
-
 /* BUNDLE_MARGIN_FACTOR should be:
 - larger to avoid dithering between shapes being in or out of a bundle, because farther from the merged object
 connections are converging faster
@@ -28,24 +29,15 @@ connections are converging faster
 - smaller to avoid jumps in fill polygons, because they're formed from shape bundle polygon centers */
 const double BUNDLE_MARGIN_FACTOR = 0.05;
 
-/* Calculates polygon x offset. Offset is non-zero only when try_i is non-zero. */
-static inline double _try_offset_x(int shape_i, int try_i, double angle_step) {
-    return cos(shape_i * angle_step) * try_i * RETRY_STEP;
-}
-
-/* Calculates polygon y offset. Offset is non-zero only when try_i is non-zero. */
-static inline double _try_offset_y(int shape_i, int try_i, double angle_step) {
-    return sin(shape_i * angle_step) * try_i * RETRY_STEP;
-}
-
 struct _Bounds {
     dvec min, max;
 };
 
 struct _Poly {
-    Shape *shapes[MAX_ENVELOPE_SHAPES];
+    Shape **shapes; /* allocated in envelope arena */
     int shapes_count;
     dvec *verts;
+    dvec *snapped_verts; /* exact tracing only, side ends for fill polygon because its sides are inflated */
     Ids ids;
     int verts_count;
     _Bounds bounds[SHAPE_CURVES];
@@ -53,6 +45,7 @@ struct _Poly {
 };
 
 static inline void _init_poly(_Poly *poly, Id t_id, Id n_id) {
+    poly->shapes = 0;
     poly->shapes_count = 0;
     poly->ids.tail = t_id;
     poly->ids.nose = n_id;
@@ -89,26 +82,461 @@ static inline bool _should_bundle_shapes(Shape *a, Shape *b, double mx, double m
     return true;
 }
 
-/* Main envelope tracing function. TODO: describe arguments. */
-bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs) {
-    assert(shapes_count < MAX_ENVELOPE_SHAPES);
+/* Gets polygon side starting at vertex i, with fill polygon sides inflated and try offset added. */
+static inline void _get_side(_Poly *poly, int i, int try_i, dvec try_offset, dvec *a, dvec *b) {
+    *a = poly->verts[i];
+    *b = poly->verts[(i + 1 < poly->verts_count) ? i + 1 : 0];
+
+    if (poly->shapes_count == 0) { /* inflate fill polygon sides */
+        double sx = b->x - a->x;
+        double sy = b->y - a->y;
+        double sl = sqrt(sx * sx + sy * sy); // FAST_SQRT
+        double nx = sy * SHAPE_FILL_POLY_MARGIN / sl;
+        double ny = -sx * SHAPE_FILL_POLY_MARGIN / sl;
+        a->x += nx;
+        a->y += ny;
+        b->x += nx;
+        b->y += ny;
+    }
+
+    if (try_i != 0) { /* add try offset */
+        a->x += try_offset.x;
+        a->y += try_offset.y;
+        b->x += try_offset.x;
+        b->y += try_offset.y;
+    }
+}
+
+/* Closest intersection found so far along the side being traced. */
+struct _SideIsec {
+    int poly_i;
+    int subdiv_i;
+    double t1, t2;
+    dvec p;
+    double p1, o3, d, dot; /* exact tracing, t1 = p1 / d and t2 = -o3 / d */
+};
+
+/* Intersects s1-s2 side with s3-s4 side of another polygon, and keeps the intersection if it's closer
+than the one found so far. Returns false if the intersection is numerically uncertain and tracing
+should be retried. */
+static inline bool _intersect_sides(dvec s1, dvec s2, dvec s3, dvec s4, double point_t2,
+                                    int poly_i, int subdiv_i, _SideIsec *isec) {
+    double t1, t2;
+
+    { /* try intersecting lines */
+        double d = (s1.x - s2.x) * (s3.y - s4.y) - (s1.y - s2.y) * (s3.x - s4.x);
+        if (d > PARALLEL_MARGIN) /* wrong direction */
+            return true;
+        else if (d > -PARALLEL_MARGIN) { /* parallel lines */
+            double nx = s2.y - s1.y;
+            double ny = s1.x - s2.x;
+            double nl = sqrt(nx * nx + ny * ny);
+            nx /= nl;
+            ny /= nl;
+            double dx = s3.x - s1.x;
+            double dy = s3.y - s1.y;
+            double dot = nx * dx + ny * dy;
+            if (dot < RETRY_MARGIN && dot > -RETRY_MARGIN) /* if parallel edge lines are too close */
+                return false;
+            return true;
+        }
+        else { /* test for intersection */
+            t1 = ((s1.x - s3.x) * (s3.y - s4.y) - (s1.y - s3.y) * (s3.x - s4.x)) / d;
+            t2 = -((s1.x - s2.x) * (s1.y - s3.y) - (s1.y - s2.y) * (s1.x - s3.x)) / d;
+        }
+    }
+
+    /* permissive test if line segments intersect, because some retry tests below don't make sense if this doesn't pass */
+
+    if (t1 < -RETRY_MARGIN || t1 > ONE_PLUS_RETRY_MARGIN ||
+        t2 < -RETRY_MARGIN || t2 > ONE_PLUS_RETRY_MARGIN)
+        return true;
+
+    /* retry trace if intersection is too close to a polygon corner */
+
+    {
+        double d;
+        d = t1 - point_t2;
+        if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
+            return false;
+        d = t1 - isec->t1;
+        if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
+            return false;
+        d = t2 - 0.0;
+        if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
+            return false;
+        d = t2 - 1.0;
+        if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
+            return false;
+    }
+
+    /* final test if line segments intersect */
+
+    if (t1 < point_t2 || t1 > isec->t1 || t2 < 0.0 || t2 > 1.0)
+        return true;
+
+    isec->t1 = t1;
+    isec->t2 = t2;
+    isec->poly_i = poly_i;
+    isec->subdiv_i = subdiv_i;
+    isec->p.x = s3.x + (s4.x - s3.x) * t2;
+    isec->p.y = s3.y + (s4.y - s3.y) * t2;
+    return true;
+}
+
+/* Exact tracing. Polygon sides are snapped to an integer grid fine enough not to matter for the envelope, so
+orientations of snapped points are exact in doubles, and products of them are compared exactly. Intersections
+exactly at polygon vertices or exactly at the same point are resolved as if the traced side was moved outwards
+by an infinitesimal distance, so tracing never has to be retried. */
+
+struct _Snap {
+    dvec origin;
+    double scale; /* power of two */
+};
+
+/* Where exact tracing entered the side being traced. */
+struct _ExactEntry {
+    bool is_intersection;   /* otherwise side was entered at its first vertex */
+    double t_num, t_den;    /* entry t */
+    double k_num, k_den;    /* how entry t changes when the side is moved outwards, breaks ties */
+};
+
+static inline dvec _snap(_Snap *snap, dvec v) {
+    dvec r;
+    r.x = floor((v.x - snap->origin.x) * snap->scale + 0.5);
+    r.y = floor((v.y - snap->origin.y) * snap->scale + 0.5);
+    return r;
+}
+
+/* Sets up snapping and snaps polygon vertices. */
+static void _init_snap(Arena *arena, _Snap *snap, _Poly *polys, int polys_count) {
+    dvec lo, hi;
+    lo.x = lo.y = DBL_MAX;
+    hi.x = hi.y = -DBL_MAX;
+    for (int i = 0; i < polys_count; ++i)
+        for (int j = 0; j < polys[i].verts_count; ++j) {
+            dvec v = polys[i].verts[j];
+            lo.x = (v.x < lo.x) ? v.x : lo.x;
+            lo.y = (v.y < lo.y) ? v.y : lo.y;
+            hi.x = (v.x > hi.x) ? v.x : hi.x;
+            hi.y = (v.y > hi.y) ? v.y : hi.y;
+        }
+
+    snap->origin.x = (lo.x + hi.x) * 0.5;
+    snap->origin.y = (lo.y + hi.y) * 0.5;
+    double extent = ((hi.x - lo.x > hi.y - lo.y) ? (hi.x - lo.x) : (hi.y - lo.y)) * 0.5 + SHAPE_FILL_POLY_MARGIN;
+    int exponent;
+    frexp(extent, &exponent); /* extent < 2^exponent */
+    snap->scale = ldexp(1.0, _EXACT_BITS - 1 - exponent);
+
+    dvec zero;
+    zero.x = zero.y = 0.0;
+
+    for (int i = 0; i < polys_count; ++i) {
+        _Poly *p = polys + i;
+        if (p->shapes_count == 0) { /* fill polygon sides are snapped after inflating */
+            p->snapped_verts = arena->alloc<dvec>(p->verts_count * 2);
+            for (int j = 0; j < p->verts_count; ++j) {
+                dvec *side = p->snapped_verts + j * 2;
+                _get_side(p, j, 0, zero, side, side + 1);
+                side[0] = _snap(snap, side[0]);
+                side[1] = _snap(snap, side[1]);
+            }
+        }
+        else {
+            p->snapped_verts = arena->alloc<dvec>(p->verts_count);
+            for (int j = 0; j < p->verts_count; ++j)
+                p->snapped_verts[j] = _snap(snap, p->verts[j]);
+        }
+    }
+}
+
+/* Gets snapped polygon side starting at vertex i. */
+static inline void _get_snapped_side(_Poly *poly, int i, dvec *a, dvec *b) {
+    if (poly->shapes_count == 0) {
+        *a = poly->snapped_verts[i * 2];
+        *b = poly->snapped_verts[i * 2 + 1];
+    }
+    else {
+        *a = poly->snapped_verts[i];
+        *b = poly->snapped_verts[(i + 1 < poly->verts_count) ? i + 1 : 0];
+    }
+}
+
+/* Adds x to expansion h of count non-overlapping components in increasing magnitude, exactly. */
+static inline int _grow_expansion(double *h, int count, double x) {
+    for (int i = 0; i < count; ++i) { /* two-sum */
+        double s = x + h[i];
+        double b = s - x;
+        h[i] = (x - (s - b)) + (h[i] - b);
+        x = s;
+    }
+    h[count] = x;
+    return count + 1;
+}
+
+/* Sign of a * b - c * d, computed exactly. */
+static int _products_diff_sign(double a, double b, double c, double d) {
+    double p = a * b;
+    double q = c * d;
+    double diff = p - q;
+    if (fabs(diff) > (fabs(p) + fabs(q)) * 1.0e-15) /* rounding errors can't change the sign */
+        return (diff > 0.0) ? 1 : -1;
+
+    double h[4];
+    int count = 0;
+    count = _grow_expansion(h, count, fma(a, b, -p));
+    count = _grow_expansion(h, count, -fma(c, d, -q));
+    count = _grow_expansion(h, count, p);
+    count = _grow_expansion(h, count, -q);
+    for (int i = count - 1; i >= 0; --i) /* largest non-zero component decides */
+        if (h[i] != 0.0)
+            return (h[i] > 0.0) ? 1 : -1;
+    return 0;
+}
+
+/* Sign of a / b - c / d, b and d are non-zero. */
+static inline int _fractions_diff_sign(double a, double b, double c, double d) {
+    int sign = _products_diff_sign(a, d, c, b);
+    return ((b > 0.0) == (d > 0.0)) ? sign : -sign;
+}
+
+/* Exact version of _intersect_sides() for snapped sides. Of sides crossing at the same t the one that would
+be crossed first if s1-s2 was moved outwards is kept. */
+static inline void _intersect_sides_exact(dvec s1, dvec s2, dvec s3, dvec s4, _ExactEntry *entry,
+                                          int poly_i, int subdiv_i, _SideIsec *isec) {
+    double ux = s2.x - s1.x;
+    double uy = s2.y - s1.y;
+    double vx = s4.x - s3.x;
+    double vy = s4.y - s3.y;
+
+    double d = ux * vy - uy * vx;
+    if (d >= 0.0) /* wrong direction or parallel */
+        return;
+
+    /* s3-s4 crosses s1-s2 line, s3 on the line counts as crossing and s4 doesn't */
+
+    double o3 = ux * (s3.y - s1.y) - uy * (s3.x - s1.x);
+    double o4 = ux * (s4.y - s1.y) - uy * (s4.x - s1.x);
+    if (o3 < 0.0 || o4 >= 0.0)
+        return;
+
+    /* s3-s4 line crosses s1-s2, crossing at s2 is found when tracing the next side */
+
+    double p1 = vx * (s1.y - s3.y) - vy * (s1.x - s3.x);
+    double p2 = vx * (s2.y - s3.y) - vy * (s2.x - s3.x);
+    if (p2 <= 0.0 || p1 > 0.0) /* or before s1 */
+        return;
+
+    /* crossing is after the entry point */
+
+    double dot = ux * vx + uy * vy;
+    if (entry->is_intersection) {
+        int sign = _fractions_diff_sign(p1, d, entry->t_num, entry->t_den);
+        if (sign < 0 || (sign == 0 && _fractions_diff_sign(-dot, d, entry->k_num, entry->k_den) <= 0))
+            return;
+    }
+
+    /* crossing is closer than the closest one so far */
+
+    if (isec->poly_i != -1) {
+        int sign = _fractions_diff_sign(p1, d, isec->p1, isec->d);
+        if (sign > 0 || (sign == 0 && _fractions_diff_sign(-dot, d, -isec->dot, isec->d) >= 0))
+            return;
+    }
+
+    isec->poly_i = poly_i;
+    isec->subdiv_i = subdiv_i;
+    isec->p1 = p1;
+    isec->o3 = o3;
+    isec->d = d;
+    isec->dot = dot;
+}
+
+/* Tests another polygon's side against s1-s2 side, which is snapped if snap is given. Returns false if
+tracing should be retried. */
+static inline bool _test_side(_Poly *poly, int poly_i, int subdiv_i, int try_i, dvec try_offset, _Snap *snap,
+                              dvec s1, dvec s2, double point_t2, _ExactEntry *entry, _SideIsec *isec) {
+    dvec s3, s4;
+    if (snap) {
+        _get_snapped_side(poly, subdiv_i, &s3, &s4);
+        _intersect_sides_exact(s1, s2, s3, s4, entry, poly_i, subdiv_i, isec);
+        return true;
+    }
+    _get_side(poly, subdiv_i, try_i, try_offset, &s3, &s4);
+    return _intersect_sides(s1, s2, s3, s4, point_t2, poly_i, subdiv_i, isec);
+}
+
+/* Uniform grid over shape polygon sides. Sides are identified by poly_i * shape_subdivs + subdiv_i
+and are stored in increasing order in each cell, so found sides can be tested in the same order as
+when going through polygons. */
+struct _SideGrid {
+    int dim;
+    double min_x, min_y;
+    double inv_cell_w, inv_cell_h;
+    int *cells;         /* side offsets, cell i sides are [cells[i], cells[i + 1]) */
+    int *sides;
+    _Bounds *bounds;    /* of each side, with broad-phase margin */
+    int *stamps;        /* last search each side was found in */
+    int stamp;
+};
+
+/* Range of grid cells a side overlaps. */
+struct _Cells {
+    int x1, y1, x2, y2;
+};
+
+static inline int _grid_coord(double v, double lo, double inv_cell_size, int dim) {
+    int c = (int)((v - lo) * inv_cell_size);
+    if (c < 0)
+        return 0;
+    if (c >= dim)
+        return dim - 1;
+    return c;
+}
+
+/* Bounds of polygon side starting at vertex j, with broad-phase margin. Both broad phases only test sides whose
+bounds overlap the traced side, so they test the same sides. */
+static inline void _side_bounds(dvec *verts, int verts_count, int j, _Bounds *sb) {
+    dvec a = verts[j];
+    dvec b = verts[(j + 1 < verts_count) ? j + 1 : 0];
+    sb->min.x = ((a.x < b.x) ? a.x : b.x) - BROAD_PHASE_MARGIN;
+    sb->min.y = ((a.y < b.y) ? a.y : b.y) - BROAD_PHASE_MARGIN;
+    sb->max.x = ((a.x > b.x) ? a.x : b.x) + BROAD_PHASE_MARGIN;
+    sb->max.y = ((a.y > b.y) ? a.y : b.y) + BROAD_PHASE_MARGIN;
+}
+
+static void _make_side_grid(Arena *arena, _SideGrid *g, _Poly *polys, int polys_count, int shape_subdivs) {
+    int count = polys_count * shape_subdivs;
+    g->bounds = arena->alloc<_Bounds>(count);
+    g->stamps = arena->alloc<int>(count, true);
+    g->stamp = 0;
+
+    /* side bounds */
+
+    dvec lo, hi;
+    lo.x = lo.y = DBL_MAX;
+    hi.x = hi.y = -DBL_MAX;
+
+    for (int i = 0; i < polys_count; ++i) {
+        for (int j = 0; j < shape_subdivs; ++j) {
+            _Bounds *sb = g->bounds + i * shape_subdivs + j;
+            _side_bounds(polys[i].verts, shape_subdivs, j, sb);
+            if (sb->min.x < lo.x)
+                lo.x = sb->min.x;
+            if (sb->min.y < lo.y)
+                lo.y = sb->min.y;
+            if (sb->max.x > hi.x)
+                hi.x = sb->max.x;
+            if (sb->max.y > hi.y)
+                hi.y = sb->max.y;
+        }
+    }
+
+    g->dim = (int)sqrt((double)count) + 1;
+    if (g->dim > _MAX_GRID_DIM)
+        g->dim = _MAX_GRID_DIM;
+    g->min_x = lo.x;
+    g->min_y = lo.y;
+    g->inv_cell_w = (hi.x > lo.x) ? g->dim / (hi.x - lo.x) : 0.0;
+    g->inv_cell_h = (hi.y > lo.y) ? g->dim / (hi.y - lo.y) : 0.0;
+
+    /* count sides in cells they overlap */
+
+    int cells_count = g->dim * g->dim;
+    g->cells = arena->alloc<int>(cells_count + 1, true);
+    _Cells *side_cells = arena->alloc<_Cells>(count);
+
+    for (int i = 0; i < count; ++i) {
+        _Bounds *sb = g->bounds + i;
+        _Cells *sc = side_cells + i;
+        sc->x1 = _grid_coord(sb->min.x, g->min_x, g->inv_cell_w, g->dim);
+        sc->y1 = _grid_coord(sb->min.y, g->min_y, g->inv_cell_h, g->dim);
+        sc->x2 = _grid_coord(sb->max.x, g->min_x, g->inv_cell_w, g->dim);
+        sc->y2 = _grid_coord(sb->max.y, g->min_y, g->inv_cell_h, g->dim);
+        for (int y = sc->y1; y <= sc->y2; ++y)
+            for (int x = sc->x1; x <= sc->x2; ++x)
+                ++g->cells[y * g->dim + x + 1];
+    }
+
+    for (int i = 0; i < cells_count; ++i) /* counts to cell beginnings */
+        g->cells[i + 1] += g->cells[i];
+
+    /* bucket sides */
+
+    g->sides = arena->alloc<int>(g->cells[cells_count]);
+
+    for (int i = 0; i < count; ++i) {
+        _Cells *sc = side_cells + i;
+        for (int y = sc->y1; y <= sc->y2; ++y)
+            for (int x = sc->x1; x <= sc->x2; ++x)
+                g->sides[g->cells[y * g->dim + x]++] = i;
+    }
+
+    for (int i = cells_count; i > 0; --i) /* filling moved cell beginnings to their ends, move them back */
+        g->cells[i] = g->cells[i - 1];
+    g->cells[0] = 0;
+}
+
+/* Finds sides whose bounds overlap given bounds, in increasing order. */
+static int _find_sides(_SideGrid *g, double min_x, double min_y, double max_x, double max_y, int *found) {
+    ++g->stamp;
+    int count = 0;
+
+    int x1 = _grid_coord(min_x, g->min_x, g->inv_cell_w, g->dim);
+    int y1 = _grid_coord(min_y, g->min_y, g->inv_cell_h, g->dim);
+    int x2 = _grid_coord(max_x, g->min_x, g->inv_cell_w, g->dim);
+    int y2 = _grid_coord(max_y, g->min_y, g->inv_cell_h, g->dim);
+
+    for (int y = y1; y <= y2; ++y)
+        for (int x = x1; x <= x2; ++x) {
+            int cell_i = y * g->dim + x;
+            for (int j = g->cells[cell_i]; j < g->cells[cell_i + 1]; ++j) {
+                int side_i = g->sides[j];
+                if (g->stamps[side_i] == g->stamp)
+                    continue;
+                g->stamps[side_i] = g->stamp;
+
+                _Bounds *sb = g->bounds + side_i;
+                if (min_x > sb->max.x || max_x < sb->min.x ||
+                    min_y > sb->max.y || max_y < sb->min.y)
+                    continue;
+
+                int k = count++; /* insert in order */
+                for (; k > 0 && found[k - 1] > side_i; --k)
+                    found[k] = found[k - 1];
+                found[k] = side_i;
+            }
+        }
+
+    return count;
+}
+
+/* Main envelope tracing function. TODO: describe arguments. With exact set envelope is traced in a single
+pass, otherwise tracing is retried with slightly moved polygons on numeric uncertainty, retries returns how
+many times. */
+bool mesh_trace_envelope(Arena *env_arena, TraceEnv *env, Shape **shapes, int shapes_count, int curve_subdivs,
+                         bool exact, int *retries) {
     assert(curve_subdivs >= MIN_CURVE_SUBDIVS);
     assert(curve_subdivs <= MAX_CURVE_SUBDIVS);
 
     env->count = 0;
+    *retries = 0;
 
-    env_arena.clear();
+    env_arena->clear();
 
     if (shapes_count == 0) /* no shapes, no envelope */
         return true;
 
     int shape_subdivs = SHAPE_CURVES * curve_subdivs;
+    int max_points = MAX_TRACE_ENV_POINTS(shapes_count, shape_subdivs);
+    assert(max_points <= env->max_count);
 
     /* Bundle shapes into polygons. Most of the polygons will only contain a single shape, but in
     merge situations we want those shapes that almost perfectly overlap each other to be represented
     by a single polygon when tracing. */
 
-    _Poly polys[MAX_ENVELOPE_SHAPES + 1];
+    _Poly *polys = env_arena->alloc<_Poly>(shapes_count + 1); /* every poly has at least one shape, and there's the fill poly */
     int polys_count = 0;
 
     {
@@ -121,8 +549,12 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
             - If conn shape whose neither origin parts are bundled - single shape poly.
             - Else, add shape to appropriate bundle poly. */
 
+        int ids_count = 0; /* only clear the part of the map shapes' ids can reach */
+        for (int i = 0; i < shapes_count; ++i)
+            ids_count = max_i(ids_count, max_i(shapes[i]->ids.tail, shapes[i]->ids.nose) + 1);
+
         _Poly *bundle_polys_map[MAX_ELEM_REFS];
-        memset(bundle_polys_map, 0, sizeof(_Poly *) * MAX_ELEM_REFS);
+        memset(bundle_polys_map, 0, sizeof(_Poly *) * ids_count);
 
         for (int a_i = 0; a_i < shapes_count; ++a_i) {
             Shape *a = shapes[a_i];
@@ -159,13 +591,15 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
             }
         }
 
+        _Poly **shape_polys = env_arena->alloc<_Poly *>(shapes_count);
+
         for (int i = 0; i < shapes_count; ++i) {
             Shape *s = shapes[i];
+            _Poly *p;
 
             if (s->ids.tail == s->ids.nose) { /* object shape */
-                _Poly *p = polys + polys_count++;
+                p = polys + polys_count++;
                 _init_poly(p, s->ids.tail, s->ids.nose);
-                p->shapes[p->shapes_count++] = s;
             }
             else { /* conn shape */
                 _Poly *t_bundle_p = bundle_polys_map[s->ids.tail];
@@ -174,15 +608,32 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                 assert(t_bundle_p == 0 || n_bundle_p == 0); /* shape should not be in two bundles at the same time */
 
                 if (t_bundle_p)
-                    t_bundle_p->shapes[t_bundle_p->shapes_count++] = s;
+                    p = t_bundle_p;
                 else if (n_bundle_p)
-                    n_bundle_p->shapes[n_bundle_p->shapes_count++] = s;
+                    p = n_bundle_p;
                 else {
-                    _Poly *p = polys + polys_count++;
+                    p = polys + polys_count++;
                     _init_poly(p, s->ids.tail, s->ids.nose);
-                    p->shapes[p->shapes_count++] = s;
                 }
             }
+
+            shape_polys[i] = p;
+            ++p->shapes_count;
+        }
+
+        /* set up polygon shapes storage, now we have shape counts */
+
+        Shape **poly_shapes = env_arena->alloc<Shape *>(shapes_count);
+        for (int i = 0; i < polys_count; ++i) {
+            _Poly *p = polys + i;
+            p->shapes = poly_shapes;
+            poly_shapes += p->shapes_count;
+            p->shapes_count = 0;
+        }
+
+        for (int i = 0; i < shapes_count; ++i) {
+            _Poly *p = shape_polys[i];
+            p->shapes[p->shapes_count++] = shapes[i];
         }
     }
 
@@ -199,29 +650,13 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
     /* sample polygons */
 
     {
-        double dt = 1.0 / curve_subdivs;
-
         for (int i = 0; i < polys_count; ++i) {
             _Poly *p = polys + i;
-            p->verts = env_arena.alloc<dvec>(shape_subdivs);
+            p->verts = env_arena->alloc<dvec>(shape_subdivs);
             p->verts_count = shape_subdivs;
 
             if (p->shapes_count == 1) { /* simple case when there's only one shape in polygon */
-                Curve *curves = p->shapes[0]->curves;
-
-                for (int j = 0; j < SHAPE_CURVES; ++j) {
-                    Curve *curve1 = curves + j;
-                    Curve *curve2 = curves + ((j + 1) % SHAPE_CURVES);
-                    dvec *curve_verts = p->verts + j * curve_subdivs;
-
-                    for (int k = 0; k < curve_subdivs; ++k)
-                        curve_verts[k] = shape_bezier(
-                            curve1->x, curve1->y,
-                            curve1->cx, curve1->cy,
-                            curve2->x, curve2->y,
-                            k * dt, curve1->w);
-                }
-
+                shape_sample_bundle(p->shapes, 1, curve_subdivs, p->verts);
                 p->center = shape_centroid(p->shapes[0]);
             }
             else {
@@ -230,23 +665,24 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                 putting all vertices for a subdivision next to each other. Then we find the outermost one of these
                 along the average normal. */
 
-                dvec *verts = env_arena.lock<dvec>(shape_subdivs * p->shapes_count);
+                dvec *verts = env_arena->lock<dvec>(shape_subdivs * p->shapes_count);
+                int *outermost_shape_indices = env_arena->lock<int>(shape_subdivs * p->shapes_count);
+                int outermost_counts[MAX_SHAPE_SUBDIVS];
                 dvec centroid = mesh_polygonize_shape_bundle(p->shapes, p->shapes_count, shape_subdivs, verts);
-
-                static int outermost_shape_indices[MAX_ELEM_REFS];
-                double subdiv_da = TAU / shape_subdivs;
+                mesh_find_outermost_shapes(verts, centroid, shape_subdivs, p->shapes_count, outermost_counts, outermost_shape_indices);
 
                 for (int subdiv_i = 0; subdiv_i < shape_subdivs; ++subdiv_i) { /* find outermost vertex for each subdivision */
-                    int count = mesh_find_outermost_shapes_for_subdivision(verts, centroid, subdiv_i, subdiv_da, p->shapes_count, outermost_shape_indices);
+                    int count = outermost_counts[subdiv_i];
+                    int *subdiv_indices = outermost_shape_indices + subdiv_i * p->shapes_count;
                     dvec *subdiv_verts = verts + subdiv_i * p->shapes_count;
 
                     if (count == 1)     /* single outermost vertex found */
-                        p->verts[subdiv_i] = subdiv_verts[outermost_shape_indices[0]];
+                        p->verts[subdiv_i] = subdiv_verts[subdiv_indices[0]];
                     else {              /* multiple outermost vertices found */
                         dvec r;
                         r.x = r.y = 0.0;
                         for (int c = 0; c < count; ++c) {
-                            dvec v = subdiv_verts[outermost_shape_indices[c]];
+                            dvec v = subdiv_verts[subdiv_indices[c]];
                             r.x += v.x;
                             r.y += v.y;
                         }
@@ -257,7 +693,8 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                     }
                 }
 
-                env_arena.unlock();
+                env_arena->unlock();
+                env_arena->unlock();
 
                 p->center.x = 0.0;
                 p->center.y = 0.0;
@@ -298,8 +735,8 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
     /* fill polygon */
 
     {
-        dvec centers[MAX_ENVELOPE_SHAPES];
-        bool ignored[MAX_ENVELOPE_SHAPES];
+        dvec *centers = env_arena->alloc<dvec>(polys_count);
+        bool *ignored = env_arena->alloc<bool>(polys_count);
 
         for (int i = 0; i < polys_count; ++i) { /* prepare all the shapes' centers */
             centers[i] = polys[i].center;
@@ -319,7 +756,7 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
         /* trace fill polygon */
 
         _Poly *poly = polys + polys_count; /* take the first available poly, but don't make it yet */
-        poly->verts = env_arena.lock<dvec>(shapes_count);
+        poly->verts = env_arena->lock<dvec>(shapes_count);
         poly->verts_count = 0;
         _init_poly(poly, -1, -1);
 
@@ -332,9 +769,9 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
             ignored[first_center] = true;
 
             int fill_guard = 0;
-            for (; fill_guard < MAX_ENVELOPE_SHAPES; ++fill_guard) {
+            for (; fill_guard < polys_count; ++fill_guard) {
                 int min_i = -1;
-                double min_angle = DBL_MAX;
+                double max_dot = -DBL_MAX; /* angles are in [0, pi] here, so the smallest one has the largest cosine */
                 double min_sx, min_sy;
 
                 for (int i = 0; i < polys_count; ++i) {
@@ -351,9 +788,9 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                     dy /= dl;
                     if (signbit(sx * dy - sy * dx)) /* if angle is negative */
                         continue;
-                    double angle = acos(sx * dx + sy * dy);
-                    if (angle < min_angle) {
-                        min_angle = angle;
+                    double dot = sx * dx + sy * dy;
+                    if (dot > max_dot) {
+                        max_dot = dot;
                         min_i = i;
                         min_sx = dx;
                         min_sy = dy;
@@ -371,16 +808,16 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                 }
             }
 
-            if (fill_guard == MAX_ENVELOPE_SHAPES) /* tracing fill polygon failed */
+            if (fill_guard == polys_count) /* tracing fill polygon failed */
                 return false;
         }
 
-        env_arena.unlock();
+        env_arena->unlock();
 
         /* if there is a fill polygon allocate vertices that have just been unlocked and add the bundle to the others */
 
         if (poly->verts_count > 1) {
-            env_arena.alloc<dvec>(poly->verts_count);
+            env_arena->alloc<dvec>(poly->verts_count);
             ++polys_count;
         }
     }
@@ -401,13 +838,49 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
     can produce errors which can guide the trace in a completely wrong direction. To avoid these situations whenever
     there's a numeric uncertainty we move all the polygons in different directions by some small distance and try again.
         There are two sources of numeric uncertainty: when a calculated intersection is too close to a polygon point,
-    and when two tested polygon sides are parallel and too close to each other. */
+    and when two tested polygon sides are parallel and too close to each other. Exact tracing doesn't have them. */
+
+    /* With enough shape polygons their sides go into a grid, so tracing only tests sides near the current
+    one, otherwise quadrant bounds are enough. Fill polygon has at most one vertex per shape, so its sides
+    are always tested. */
+
+    int shape_polys_count = (polys[polys_count - 1].shapes_count == 0) ? (polys_count - 1) : polys_count;
+
+    _SideGrid grid = {}; /* dim stays 0 when there's no grid */
+    int *found_sides = 0;
+    if (shape_polys_count >= _GRID_MIN_POLYS) {
+        _make_side_grid(env_arena, &grid, polys, shape_polys_count, shape_subdivs);
+        found_sides = env_arena->alloc<int>(shape_polys_count * shape_subdivs);
+    }
+    dvec *try_offsets = env_arena->alloc<dvec>(polys_count, true); /* no offsets on the first try */
+    dvec *try_dirs = env_arena->alloc<dvec>(polys_count); /* polygon offset directions, calculated on first retry */
+
+    _Snap snap;
+    _Snap *exact_snap = 0;
+    double query_margin = 0.0; /* snapping moves side ends by up to half a grid step */
+    if (exact) {
+        _init_snap(env_arena, &snap, polys, polys_count);
+        exact_snap = &snap;
+        query_margin = 1.0 / snap.scale;
+    }
 
     int try_i = 0;
-    double try_angle_step = 6.28318530718 / polys_count;
 
     for (; try_i < MAX_TRIES; ++try_i) {
 
+        if (try_i == 1) {
+            double try_angle_step = 6.28318530718 / polys_count;
+            for (int i = 0; i < polys_count; ++i) {
+                try_dirs[i].x = cos(i * try_angle_step);
+                try_dirs[i].y = sin(i * try_angle_step);
+            }
+        }
+
+        for (int i = 0; try_i > 0 && i < polys_count; ++i) {
+            try_offsets[i].x = try_dirs[i].x * try_i * RETRY_STEP;
+            try_offsets[i].y = try_dirs[i].y * try_i * RETRY_STEP;
+        }
+
         /* find first envelope point */
 
         EnvPoint beg_point;
@@ -426,8 +899,8 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                 _Poly *poly = polys + i;
                 if (poly->shapes_count == 0) /* skip fill polygon */
                     continue;
-                double offset_x = _try_offset_x(i, try_i, try_angle_step);
-                double offset_y = _try_offset_y(i, try_i, try_angle_step);
+                double offset_x = try_offsets[i].x;
+                double offset_y = try_offsets[i].y;
 
                 for (int j = curve_subdivs; j < curve_subdivs * 3; ++j) {
                     dvec p = poly->verts[j];
@@ -455,36 +928,21 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
         env->points[env->count++] = point;
         int point_poly_i = beg_point_poly_i;
 
-        int env_guard = 0;
-        for (; env_guard < MAX_ENVELOPE_POINTS; ++env_guard) {
+        _ExactEntry entry;
+        entry.is_intersection = false;
+
+        int env_guard = 1; /* first point is already in */
+        for (; env_guard < max_points; ++env_guard) {
 
-            bool is_fill_poly = polys[point_poly_i].shapes_count == 0;
-            double try_offset_x = _try_offset_x(point_poly_i, try_i, try_angle_step);
-            double try_offset_y = _try_offset_y(point_poly_i, try_i, try_angle_step);
             int poly_verts_count = polys[point_poly_i].verts_count;
 
             dvec s1, s2;
-            s1 = polys[point_poly_i].verts[point.subdiv_i];
-            s2 = polys[point_poly_i].verts[(point.subdiv_i + 1) % poly_verts_count];
-
-            if (is_fill_poly) { /* inflate fill polygon sides */
-                double sx = s2.x - s1.x;
-                double sy = s2.y - s1.y;
-                double sl = sqrt(sx * sx + sy * sy); // FAST_SQRT
-                double nx = sy * SHAPE_FILL_POLY_MARGIN / sl;
-                double ny = -sx * SHAPE_FILL_POLY_MARGIN / sl;
-                s1.x += nx;
-                s1.y += ny;
-                s2.x += nx;
-                s2.y += ny;
-            }
+            _get_side(polys + point_poly_i, point.subdiv_i, try_i, try_offsets[point_poly_i], &s1, &s2);
 
-            if (try_i != 0) { /* add try offset */
-                s1.x += try_offset_x;
-                s1.y += try_offset_y;
-                s2.x += try_offset_x;
-                s2.y += try_offset_y;
-            }
+            dvec q1 = s1; /* side other sides are tested against, snapped for exact tracing */
+            dvec q2 = s2;
+            if (exact)
+                _get_snapped_side(polys + point_poly_i, point.subdiv_i, &q1, &q2);
 
             double s_min_x, s_min_y;
             double s_max_x, s_max_y;
@@ -504,125 +962,84 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                 s_min_y = s2.y;
                 s_max_y = s1.y;
             }
+            s_min_x -= query_margin;
+            s_min_y -= query_margin;
+            s_max_x += query_margin;
+            s_max_y += query_margin;
 
-            /* test other polygon' edges for intersection with s1-s2 edge */
-
-            int min_poly_i = -1;
-            int min_subdiv_i = -1;
-            double min_t1 = 1.0;
-            double min_t2 = 1.0;
-            dvec min_p;
-
-            for (int i = 0; i < polys_count; ++i) {
-                if (i == point_poly_i) /* skip current edge's polygon */
-                    continue;
-                _Poly *other_poly = polys + i;
+            /* test other polygons' sides for intersection with s1-s2 side, in order of polygons and their sides */
 
-                bool other_is_fill_poly = other_poly->shapes_count == 0;
-                double other_try_offset_x = _try_offset_x(i, try_i, try_angle_step);
-                double other_try_offset_y = _try_offset_y(i, try_i, try_angle_step);
-                int other_poly_verts_count = other_poly->verts_count;
+            _SideIsec isec;
+            isec.poly_i = -1;
+            isec.subdiv_i = -1;
+            isec.t1 = 1.0;
+            isec.t2 = 1.0;
 
-                int broad_count = other_is_fill_poly ? 1 : SHAPE_CURVES;
-                for (int j = 0; j < broad_count; ++j) { /* broad-phase: test if s1-s2 edge's bounds overlap with current shape's quadrant bounds */
+            if (grid.dim) {
+                int found_count = _find_sides(&grid, s_min_x, s_min_y, s_max_x, s_max_y, found_sides);
 
-                    _Bounds *bounds = other_poly->bounds + j;
-                    if (!other_is_fill_poly &&
-                        (s_min_x > bounds->max.x || s_max_x < bounds->min.x ||
-                         s_min_y > bounds->max.y || s_max_y < bounds->min.y))
+                for (int j = 0; j < found_count; ++j) {
+                    int i = found_sides[j] / shape_subdivs;
+                    if (i == point_poly_i) /* skip current side's polygon */
                         continue;
+                    int l = found_sides[j] % shape_subdivs;
+                    if (!_test_side(polys + i, i, l, try_i, try_offsets[i], exact_snap, q1, q2, point.t2, &entry, &isec))
+                        goto RETRY_TRACE;
+                }
+            }
+            else {
+                for (int i = 0; i < shape_polys_count; ++i) {
+                    if (i == point_poly_i) /* skip current side's polygon */
+                        continue;
+                    _Poly *other_poly = polys + i;
 
-                    int narrow_count = other_is_fill_poly ? other_poly_verts_count : curve_subdivs;
-                    for (int k = 0; k < narrow_count; ++k) { /* narrow-phase: test s1-s2 s3-s4 intersection */
-                        int l = j * narrow_count + k;
-
-                        dvec s3 = other_poly->verts[l];
-                        dvec s4 = other_poly->verts[(l + 1 < other_poly_verts_count) ? l + 1 : 0];
-
-                        if (other_is_fill_poly) { /* inflate fill polygon sides */
-                            double sx = s4.x - s3.x;
-                            double sy = s4.y - s3.y;
-                            double sl = sqrt(sx * sx + sy * sy);
-                            double nx = sy * SHAPE_FILL_POLY_MARGIN / sl;
-                            double ny = -sx * SHAPE_FILL_POLY_MARGIN / sl;
-                            s3.x += nx;
-                            s3.y += ny;
-                            s4.x += nx;
-                            s4.y += ny;
-                        }
-
-                        if (try_i != 0) { /* add try offset */
-                            s3.x += other_try_offset_x;
-                            s3.y += other_try_offset_y;
-                            s4.x += other_try_offset_x;
-                            s4.y += other_try_offset_y;
-                        }
-
-                        double t1, t2;
-
-                        { /* try intersecting lines */
-                            double d = (s1.x - s2.x) * (s3.y - s4.y) - (s1.y - s2.y) * (s3.x - s4.x);
-                            if (d > PARALLEL_MARGIN) /* wrong direction */
-                                continue;
-                            else if (d > -PARALLEL_MARGIN) { /* parallel lines */
-                                double nx = s2.y - s1.y;
-                                double ny = s1.x - s2.x;
-                                double nl = sqrt(nx * nx + ny * ny);
-                                nx /= nl;
-                                ny /= nl;
-                                double dx = s3.x - s1.x;
-                                double dy = s3.y - s1.y;
-                                double dot = nx * dx + ny * dy;
-                                if (dot < RETRY_MARGIN && dot > -RETRY_MARGIN) /* if parallel edge lines are too close */
-                                    goto RETRY_TRACE;
-                                continue;
-                            }
-                            else { /* test for intersection */
-                                t1 = ((s1.x - s3.x) * (s3.y - s4.y) - (s1.y - s3.y) * (s3.x - s4.x)) / d;
-                                t2 = -((s1.x - s2.x) * (s1.y - s3.y) - (s1.y - s2.y) * (s1.x - s3.x)) / d;
-                            }
-                        }
-
-                        /* permissive test if line segments intersect, because some retry tests below don't make sense if this doesn't pass */
-
-                        if (t1 < -RETRY_MARGIN || t1 > ONE_PLUS_RETRY_MARGIN ||
-                            t2 < -RETRY_MARGIN || t2 > ONE_PLUS_RETRY_MARGIN)
+                    for (int j = 0; j < SHAPE_CURVES; ++j) { /* broad-phase: test if s1-s2 side's bounds overlap with other polygon's quadrant bounds */
+                        _Bounds *bounds = other_poly->bounds + j;
+                        if (s_min_x > bounds->max.x || s_max_x < bounds->min.x ||
+                            s_min_y > bounds->max.y || s_max_y < bounds->min.y)
                             continue;
 
-                        /* retry trace if intersection is too close to a polygon corner */
-
-                        {
-                            double d;
-                            d = t1 - point.t2;
-                            if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
-                                goto RETRY_TRACE;
-                            d = t1 - min_t1;
-                            if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
-                                goto RETRY_TRACE;
-                            d = t2 - 0.0;
-                            if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
-                                goto RETRY_TRACE;
-                            d = t2 - 1.0;
-                            if (d < RETRY_MARGIN && d > -RETRY_MARGIN)
+                        for (int k = 0; k < curve_subdivs; ++k) { /* narrow-phase */
+                            int l = j * curve_subdivs + k;
+                            _Bounds sb;
+                            _side_bounds(other_poly->verts, shape_subdivs, l, &sb);
+                            if (s_min_x > sb.max.x || s_max_x < sb.min.x ||
+                                s_min_y > sb.max.y || s_max_y < sb.min.y)
+                                continue;
+                            if (!_test_side(other_poly, i, l, try_i, try_offsets[i], exact_snap, q1, q2, point.t2, &entry, &isec))
                                 goto RETRY_TRACE;
                         }
+                    }
+                }
+            }
 
-                        /* final test if line segments intersect */
+            for (int i = shape_polys_count; i < polys_count; ++i) { /* fill polygon */
+                if (i == point_poly_i)
+                    continue;
 
-                        if (t1 < point.t2 || t1 > min_t1 || t2 < 0.0 || t2 > 1.0)
-                            continue;
+                for (int l = 0; l < polys[i].verts_count; ++l)
+                    if (!_test_side(polys + i, i, l, try_i, try_offsets[i], exact_snap, q1, q2, point.t2, &entry, &isec))
+                        goto RETRY_TRACE;
+            }
 
-                        min_t1 = t1;
-                        min_t2 = t2;
-                        min_poly_i = i;
-                        min_subdiv_i = l;
-                        min_p.x = s3.x + (s4.x - s3.x) * t2;
-                        min_p.y = s3.y + (s4.y - s3.y) * t2;
-                    }
-                }
+            if (exact && isec.poly_i != -1) { /* intersection from exact values, on the side before snapping */
+                isec.t1 = isec.p1 / isec.d;
+                isec.t2 = -isec.o3 / isec.d;
+                dvec s3, s4;
+                _get_side(polys + isec.poly_i, isec.subdiv_i, try_i, try_offsets[isec.poly_i], &s3, &s4);
+                isec.p.x = s3.x + (s4.x - s3.x) * isec.t2;
+                isec.p.y = s3.y + (s4.y - s3.y) * isec.t2;
+
+                entry.is_intersection = true;
+                entry.t_num = -isec.o3;
+                entry.t_den = isec.d;
+                entry.k_num = isec.dot;
+                entry.k_den = isec.d;
             }
+            else
+                entry.is_intersection = false;
 
-            if (min_poly_i == -1) {     /* no intersection found */
+            if (isec.poly_i == -1) {    /* no intersection found */
                 point.is_intersection = false;
                 point.i1 = point.subdiv_i;
                 int i2 = (point.subdiv_i + 1) % poly_verts_count;
@@ -636,15 +1053,15 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
             }
             else {                      /* intersection found */
                 point.is_intersection = true;
-                point_poly_i = min_poly_i;
+                point_poly_i = isec.poly_i;
                 point.i1 = point.subdiv_i;
-                point.i2 = min_subdiv_i;
-                point.subdiv_i = min_subdiv_i;
-                point.t1 = min_t1;
-                point.t2 = min_t2;
-                point.x = min_p.x;
-                point.y = min_p.y;
-                point.ids = polys[min_poly_i].ids;
+                point.i2 = isec.subdiv_i;
+                point.subdiv_i = isec.subdiv_i;
+                point.t1 = isec.t1;
+                point.t2 = isec.t2;
+                point.x = isec.p.x;
+                point.y = isec.p.y;
+                point.ids = polys[isec.poly_i].ids;
             }
 
             if (!point.is_intersection &&
@@ -656,14 +1073,17 @@ bool mesh_trace_envelope(TraceEnv *env, Shape **shapes, int shapes_count, int cu
                 env->points[env->count++] = point;
         }
 
-        if (env_guard >= MAX_ENVELOPE_POINTS) /* max envelope points exceeded */
+        if (env_guard >= max_points) { /* max envelope points exceeded */
+            *retries = try_i;
             return false;
+        }
 
         break; /* get out of the try loop */
 
     RETRY_TRACE:;
     }
 
+    *retries = try_i;
     if (try_i == MAX_TRIES) /* max retries exceeded */
         return false;
 
@@ -9,9 +9,6 @@
 #include <assert.h>
 
 
-double COLLAPSE_MARGIN = 0.4;
-double ONE_MINUS_COLLAPSE_MARGIN = 1.0 - COLLAPSE_MARGIN;
-
 static void _update_mesh_envelope_slices(MeshEnv *env) {
     env->slices_count = 0;
     MeshEnvSlice *slice = 0;
@@ -39,6 +36,7 @@ static void _update_mesh_envelope_slices(MeshEnv *env) {
 }
 
 static void _add_mesh_point(MeshEnv *env, EnvPoint *ep, int i1, int i2, int vert_i) {
+    assert(env->count < env->max_count);
     MeshPoint *mp = env->points + env->count++;
     mp->x = ep->x;
     mp->y = ep->y;
@@ -55,10 +53,11 @@ static void _add_mesh_point(MeshEnv *env, EnvPoint *ep, int i1, int i2, int vert
 /* Check if current non-intersection point should be skipped. This could be due
 to previous or next point being intersection. */
 static inline bool _do_we_skip_non_intersection(bool prev_is_intersection, double prev_t2,
-                                                bool next_is_intersection, double next_t1) {
-    if (prev_is_intersection && prev_t2 > ONE_MINUS_COLLAPSE_MARGIN)
+                                                bool next_is_intersection, double next_t1,
+                                                double collapse_margin) {
+    if (prev_is_intersection && prev_t2 > 1.0 - collapse_margin)
         return true;
-    if (next_is_intersection && next_t1 < COLLAPSE_MARGIN)
+    if (next_is_intersection && next_t1 < collapse_margin)
         return true;
     return false;
 }
@@ -66,17 +65,18 @@ static inline bool _do_we_skip_non_intersection(bool prev_is_intersection, doubl
 /* Should intersection point get new i1 or i2 if corresponding non-intersection point was skipped. */
 static inline void _do_we_fix_intersection_i1_i2(bool prev_is_intersection, int prev_i1,
                                                  bool next_is_intersection, int next_i2,
-                                                 double t1, double t2, int *i1, int *i2) {
-    if (!prev_is_intersection && t1 < COLLAPSE_MARGIN)
+                                                 double t1, double t2, int *i1, int *i2,
+                                                 double collapse_margin) {
+    if (!prev_is_intersection && t1 < collapse_margin)
         *i1 = prev_i1;
-    if (!next_is_intersection && t2 > ONE_MINUS_COLLAPSE_MARGIN)
+    if (!next_is_intersection && t2 > 1.0 - collapse_margin)
         *i2 = next_i2;
 }
 
 /* Creates mesh envelope points for one side of an opening. */
 static int _mesh_envs_pass_3(float section_x, vec3 *verts, int verts_count,
                              MeshEnv *env, EnvPoint *env_points, int count, int beg, int end,
-                             double beg_t, double end_t) {
+                             double beg_t, double end_t, double collapse_margin) {
 
     int _beg = period_incr(beg, count);
     int _end = period_decr(end, count);
@@ -119,10 +119,10 @@ static int _mesh_envs_pass_3(float section_x, vec3 *verts, int verts_count,
         if (ep->is_intersection)
             _do_we_fix_intersection_i1_i2(prev_is_intersection, prev_i1,
                                           next_is_intersection, next_i2,
-                                          ep->t1, ep->t2, &i1, &i2);
+                                          ep->t1, ep->t2, &i1, &i2, collapse_margin);
         else
             skip = _do_we_skip_non_intersection(prev_is_intersection, prev_t2,
-                                                next_is_intersection, next_t1);
+                                                next_is_intersection, next_t1, collapse_margin);
 
         if (!skip) {
             _add_mesh_point(env, ep, i1, i2, verts_count);
@@ -138,7 +138,7 @@ static int _mesh_envs_pass_3(float section_x, vec3 *verts, int verts_count,
 
 enum _CorrType { ctNone, ctIsec, ctOpen };
 
-static struct _Corr {
+struct _Corr {
     _CorrType type;
     bool tail_isec_opening; /* if opening, intersections are on the tail side */
     union {
@@ -151,12 +151,13 @@ static struct _Corr {
     };
     int t_end_i; /* if opening */
     int n_end_i; /* if opening */
-} *corrs = 0;
+};
 
 /* Creates mesh envelope points for both sides of an opening. */
 static int _mesh_envs_pass_2(float section_x, vec3 *verts, int verts_count, _Corr *corr,
                              MeshEnv *t_env, EnvPoint *t_env_points, int t_count,
-                             MeshEnv *n_env, EnvPoint *n_env_points, int n_count) {
+                             MeshEnv *n_env, EnvPoint *n_env_points, int n_count,
+                             double collapse_margin) {
     EnvPoint *ep1 = 0, *ep2 = 0;
     double t_beg_t, t_end_t;
     double n_beg_t, n_end_t;
@@ -194,11 +195,11 @@ static int _mesh_envs_pass_2(float section_x, vec3 *verts, int verts_count, _Cor
 
     verts_count = _mesh_envs_pass_3(section_x, verts, verts_count,
                                     t_env, t_env_points, t_count, corr->t_beg_i, corr->t_end_i,
-                                    t_beg_t, t_end_t);
+                                    t_beg_t, t_end_t, collapse_margin);
 
     verts_count = _mesh_envs_pass_3(section_x, verts, verts_count,
                                     n_env, n_env_points, n_count, corr->n_beg_i, corr->n_end_i,
-                                    n_beg_t, n_end_t);
+                                    n_beg_t, n_end_t, collapse_margin);
 
     /* clone last tail isec */
 
@@ -322,31 +323,30 @@ static bool _can_correlate_env_points(EnvPoint *a, EnvPoint *b) {
 }
 
 /* Creates mesh points from two envelopes. */
-static void _mesh_envs_pass_1(Model *model, Arena *verts_arena, float section_x,
+static void _mesh_envs_pass_1(LoftWorker *worker, float section_x,
                               MeshEnv *t_env, TraceEnv *t_trace_env,
                               MeshEnv *n_env, TraceEnv *n_trace_env) {
 
-    if (corrs == 0)
-        corrs = (_Corr *)malloc(sizeof(_Corr) * MAX_ENVELOPE_POINTS);
+    EnvPoint *t_env_points = t_trace_env->points;
+    EnvPoint *n_env_points = n_trace_env->points;
+    int t_count = t_trace_env->count;
+    int n_count = n_trace_env->count;
+
+    _Corr *corrs = worker->mesh_envs_arena->lock<_Corr>(t_count * 2); /* tail points correlate at most once, at most one opening after each */
     int corrs_count = 0;
 
     t_env->count = 0;
     n_env->count = 0;
-    t_env->verts_base_i = model->skin_verts_count;
-    n_env->verts_base_i = model->skin_verts_count;
+    t_env->verts_base_i = worker->verts_count;
+    n_env->verts_base_i = worker->verts_count;
     t_env->object_like_flags = t_trace_env->object_like_flags;
     n_env->object_like_flags = n_trace_env->object_like_flags;
 
-    vec3 *verts = verts_arena->rest<vec3>();
+    vec3 *verts = worker->verts_arena->reserve<vec3>(t_count + n_count); /* each envelope point at most once */
     int verts_count = 0;
 
     /* collect all direct and opening correlations */
 
-    EnvPoint *t_env_points = t_trace_env->points;
-    EnvPoint *n_env_points = n_trace_env->points;
-    int t_count = t_trace_env->count;
-    int n_count = n_trace_env->count;
-
     _Corr *first_corr = 0;
     _Corr *prev_corr = 0;
 
@@ -359,7 +359,7 @@ static void _mesh_envs_pass_1(Model *model, Arena *verts_arena, float section_x,
             if (_can_correlate_env_points(t_ep, n_ep)) {
 
                 if (prev_corr) /* check for zip correlations */
-                    corrs_count = _check_for_opening_corrs(model, corrs, corrs_count,
+                    corrs_count = _check_for_opening_corrs(worker->model, corrs, corrs_count,
                                                            t_env_points, t_count, prev_corr->t_i, t_i,
                                                            n_env_points, n_count, prev_corr->n_i, n_i);
 
@@ -375,7 +375,7 @@ static void _mesh_envs_pass_1(Model *model, Arena *verts_arena, float section_x,
         }
     }
 
-    corrs_count = _check_for_opening_corrs(model, corrs, corrs_count,
+    corrs_count = _check_for_opening_corrs(worker->model, corrs, corrs_count,
                                            t_env_points, t_count, prev_corr->t_i, first_corr->t_i,
                                            n_env_points, n_count, prev_corr->n_i, first_corr->n_i);
 
@@ -401,7 +401,8 @@ static void _mesh_envs_pass_1(Model *model, Arena *verts_arena, float section_x,
                 EnvPoint *next_ep = _beg_isec_point_from_corr(next_corr, t_env_points, n_env_points);
 
                 skip = _do_we_skip_non_intersection(prev_corr->type != ctNone, prev_ep->t2,
-                                                    next_corr->type != ctNone, next_ep->t1);
+                                                    next_corr->type != ctNone, next_ep->t1,
+                                                    worker->settings->collapse_margin);
             }
             else {
                 EnvPoint *beg_ep = _beg_isec_point_from_corr(corr, t_env_points, n_env_points);
@@ -409,7 +410,8 @@ static void _mesh_envs_pass_1(Model *model, Arena *verts_arena, float section_x,
 
                 _do_we_fix_intersection_i1_i2(prev_corr->type != ctNone, (t_env_points + prev_corr->t_i)->i1,
                                               next_corr->type != ctNone, (t_env_points + next_corr->t_i)->i2,
-                                              beg_ep->t1, end_ep->t2, &i1, &i2);
+                                              beg_ep->t1, end_ep->t2, &i1, &i2,
+                                              worker->settings->collapse_margin);
             }
 
             /* add to both mesh envelopes */
@@ -427,27 +429,29 @@ static void _mesh_envs_pass_1(Model *model, Arena *verts_arena, float section_x,
         else
             verts_count = _mesh_envs_pass_2(section_x, verts, verts_count, corr,
                                             t_env, t_env_points, t_count,
-                                            n_env, n_env_points, n_count);
+                                            n_env, n_env_points, n_count,
+                                            worker->settings->collapse_margin);
     }
 
-    model->skin_verts_count += verts_count;
-    verts_arena->alloc<vec3>(verts_count);
+    worker->verts_count += verts_count;
+    worker->verts_arena->alloc<vec3>(verts_count);
+    worker->mesh_envs_arena->unlock();
 
     _update_mesh_envelope_slices(t_env);
     _update_mesh_envelope_slices(n_env);
 }
 
 /* Handles simple case when there's only one shape in envelope. */
-void _mesh_envs_pass_0(Model *model, Arena *verts_arena, float section_x,
+void _mesh_envs_pass_0(LoftWorker *worker, float section_x,
                        MeshEnv *env, TraceEnv *trace_env) {
 
     /* make mesh envelope from trace envelope */
 
     env->count = 0;
-    env->verts_base_i = model->skin_verts_count;
+    env->verts_base_i = worker->verts_count;
     env->object_like_flags = trace_env->object_like_flags;
 
-    vec3 *verts = verts_arena->rest<vec3>();
+    vec3 *verts = worker->verts_arena->reserve<vec3>(trace_env->count);
     int verts_count = 0;
 
     for (int i = 0; i < trace_env->count; ++i) {
@@ -462,11 +466,13 @@ void _mesh_envs_pass_0(Model *model, Arena *verts_arena, float section_x,
 
         if (!ep->is_intersection)
             skip = _do_we_skip_non_intersection(prev_ep->is_intersection, prev_ep->t2,
-                                                next_ep->is_intersection, next_ep->t1);
+                                                next_ep->is_intersection, next_ep->t1,
+                                                worker->settings->collapse_margin);
         else
             _do_we_fix_intersection_i1_i2(prev_ep->is_intersection, prev_ep->i1,
                                           next_ep->is_intersection, next_ep->i2,
-                                          ep->t1, ep->t2, &i1, &i2);
+                                          ep->t1, ep->t2, &i1, &i2,
+                                          worker->settings->collapse_margin);
 
         /* add new mesh point and copy data from envelope point */
 
@@ -480,8 +486,8 @@ void _mesh_envs_pass_0(Model *model, Arena *verts_arena, float section_x,
         }
     }
 
-    model->skin_verts_count += verts_count;
-    verts_arena->alloc<vec3>(verts_count);
+    worker->verts_count += verts_count;
+    worker->verts_arena->alloc<vec3>(verts_count);
 
     /* group non-intersection envelope points into slices */
 
@@ -489,32 +495,17 @@ void _mesh_envs_pass_0(Model *model, Arena *verts_arena, float section_x,
 }
 
 /* Main mesh envelope making procedure. */
-void mesh_make_envelopes(Model *model, Arena *verts_arena, float section_x,
+void mesh_make_envelopes(LoftWorker *worker, float section_x,
                          MeshEnv *t_env, TraceEnv *t_trace_env,
                          MeshEnv *n_env, TraceEnv *n_trace_env) {
 
     t_env->x = n_env->x = section_x;
 
     if (t_env == n_env) /* single envelope */
-        _mesh_envs_pass_0(model, verts_arena, section_x,
+        _mesh_envs_pass_0(worker, section_x,
                           t_env, t_trace_env);
     else                /* double envelope */
-        _mesh_envs_pass_1(model, verts_arena, section_x,
+        _mesh_envs_pass_1(worker, section_x,
                           t_env, t_trace_env,
                           n_env, n_trace_env);
 }
-
-void mesh_verts_merge_margin(bool increase) {
-    if (increase) {
-        if (COLLAPSE_MARGIN < 0.5) {
-            COLLAPSE_MARGIN += 0.05;
-            ONE_MINUS_COLLAPSE_MARGIN = 1.0 - COLLAPSE_MARGIN;
-        }
-    }
-    else {
-        if (COLLAPSE_MARGIN > 0.0) {
-            COLLAPSE_MARGIN -= 0.05;
-            ONE_MINUS_COLLAPSE_MARGIN = 1.0 - COLLAPSE_MARGIN;
-        }
-    }
-}
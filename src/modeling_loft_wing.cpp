@@ -7,6 +7,7 @@
 #include "memory_arena.h"
 #include <float.h>
 #include <math.h>
+#include <assert.h>
 
 #define MAX_WING_SURFACE_STATIONS 500
 
@@ -141,6 +142,7 @@ static int _insert_wisec(Wisec *wisecs, int count, Wisec wisec) {
 
 static void _insert_wisecs_into_envelope(TraceEnv *env, Wisec *wisecs, int wisecs_count) {
     int last_loc = env->count - 1;
+    assert(env->count + wisecs_count <= env->max_count);
     while (wisecs_count > 0) {
 
         /* find wisecs batch to insert */
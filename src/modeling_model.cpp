@@ -23,11 +23,15 @@ void model_clear(Model *m) {
 
 void model_add_object(Model *m, Object *o) {
     assert(m->objects_count + m->wings_count < MAX_ELEMS);
+    o->loft_dirty = true;
+    o->coll_dirty = true;
     m->objects[m->objects_count++] = o;
 }
 
 void model_add_wing(Model *m, Wing *w) {
     assert(m->objects_count + m->wings_count < MAX_ELEMS);
+    w->loft_dirty = true;
+    w->coll_dirty = true;
     m->wings[m->wings_count++] = w;
 }
 
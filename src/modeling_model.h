@@ -2,14 +2,15 @@
 #define model_h
 
 #include "modeling_loft.h"
-
-#define MAX_FUSELAGES   32
+#include "modeling_config.h"
 
 
 struct vec3;
 struct Wing;
 struct Arena;
 struct Object;
+struct LoftContext;
+struct CollisionContext;
 
 struct Panel {
     int v1, v2, v3, v4; /* vertex indices */
@@ -17,6 +18,20 @@ struct Panel {
     float vx, vy, vz; /* airspeed components */
 };
 
+/* What happened during model_collision_run(). */
+struct CollisionReport {
+    int iterations;     /* in which elements moved */
+    float residual;     /* largest force in the last iteration */
+    bool converged;
+    bool at_rest;       /* nothing changed since elements came to rest, nothing was run */
+};
+
+/* What happened during model_loft(). */
+struct LoftReport {
+    int fuselages;      /* lofted, the others didn't change since last loft */
+    TraceStats traces;
+};
+
 struct Model {
     Object *objects[MAX_ELEMS];
     int objects_count;
@@ -48,10 +63,18 @@ bool model_delete_selected(Model *m);
 void model_serial_dump(Model *model, const char *path);
 void model_serial_load(Model *model, const char *path);
 void model_serial_dump_mesh(Model *model, const char *path);
+void model_serial_dump_mesh_binary(Model *model, const char *path);
 
-void model_collision_init();
-bool model_collision_run(Model *model, Arena *arena, bool dragging);
-void model_loft(Arena *arena, Model *model);
+/* Collision and lofting keep their memory in context objects. A model can be collided or
+lofted while other models are, as long as each one uses its own context. */
+CollisionContext *model_make_collision_context();
+void model_free_collision_context(CollisionContext *context);
+void model_set_collision_settings(CollisionContext *context, const CollisionSettings *settings);
+bool model_collision_run(CollisionContext *context, Model *model, const LoftSettings *settings, bool dragging,
+                         CollisionReport *report=0);
+LoftContext *model_make_loft_context();
+void model_free_loft_context(LoftContext *context);
+void model_loft(LoftContext *context, Model *model, const LoftSettings *settings, LoftReport *report=0);
 
 #ifdef NDEBUG
     #define model_assert(__model__, __expr__, __label__) ((void)0)
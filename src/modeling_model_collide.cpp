@@ -3,53 +3,63 @@
 #include "modeling_wing.h"
 #include "modeling_ochre.h"
 #include "modeling_collision.h"
-#include "memory_arena.h"
-#include "modeling_config.h"
+#include "util_jobs.h"
 
 
-static OcState *state;
-static OcNodeGroup *objects_group;
-static OcNodeGroup *wings_group;
+/* Ochre state and memory used to collide a model's elements, one per concurrently collided model. */
+struct CollisionContext {
+    OcState *state;
+    OcNodeGroup *objects_group;
+    OcNodeGroup *wings_group;
+    CollisionSettings settings;
+    Jobs *jobs;         /* force interaction workers, kept between runs */
 
-/* Action callback that prepares an object for interaction. */
+    /* state when elements last came to rest */
+    bool at_rest;
+    int objects_count, wings_count;
+    double structural_margin;
+};
+
+/* Action callback that prepares an object for interaction. Prisms are built in object CS
+only when object definition or margin changes, so here it's mostly just updating x extents. */
 static void _object_preparation(void *agent, void *exec_context) {
     CollContext *c = (CollContext *)exec_context;
-    Arena *arena = c->arena;
-
     Object *o = (Object *)agent;
-    o->prisms = arena->rest<CollPrism>();
-    o->prisms_count = 0;
 
-    float x = o->p.x;
-    float y = o->p.y;
-    float z = o->p.z;
+    double margin = c->structural_margin * 0.5;
+    if (o->prisms_dirty || o->prisms_margin != margin) {
+        o->prisms_count = 0;
 
-    for (int i = 0; i < o->def.formers_count; ++i) { /* a prism for each object former */
-        Former *f = o->def.formers + i;
+        for (int i = 0; i < o->def.formers_count; ++i) { /* a prism for each object former */
+            Former *f = o->def.formers + i;
 
-        CollPrism *prism = arena->alloc<CollPrism>();
-        o->prisms_count++;
+            CollPrism *prism = o->prisms + o->prisms_count++;
 
-        coll_get_prism(&f->shape, prism, y, z, STRUCTURAL_MARGIN * 0.5);
-        prism->x = f->x + x;
+            coll_get_prism(&f->shape, prism, 0.0, 0.0, margin);
+            prism->x = f->x;
 
-        if (i == 0) /* first former */
-            prism->min_x = f->x + x;
-        else
-            prism->min_x = (f->x + o->def.formers[i - 1].x) * 0.5f + x;
+            if (i == 0) /* first former */
+                prism->min_x = f->x;
+            else
+                prism->min_x = (f->x + o->def.formers[i - 1].x) * 0.5f;
 
-        if (i == o->def.formers_count - 1) /* last former */
-            prism->max_x = f->x + x;
-        else
-            prism->max_x = (f->x + o->def.formers[i + 1].x) * 0.5f + x;
+            if (i == o->def.formers_count - 1) /* last former */
+                prism->max_x = f->x;
+            else
+                prism->max_x = (f->x + o->def.formers[i + 1].x) * 0.5f;
+        }
+
+        o->prisms_dirty = false;
+        o->prisms_margin = margin;
     }
 
-    o->coll_min_x = (float)o->prisms[0].x;
-    o->coll_max_x = (float)o->prisms[o->prisms_count - 1].x;
+    o->coll_min_x = (float)(o->prisms[0].x + o->p.x);
+    o->coll_max_x = (float)(o->prisms[o->prisms_count - 1].x + o->p.x);
 }
 
-/* Interaction callback that describes interaction between objects. */
-static void _object_interaction(void *agent1, void *agent2, void *exec_context) {
+/* Interaction callback that calculates force between objects. Only reads objects, so
+it can be called for different pairs at the same time. */
+static bool _object_interaction(void *agent1, void *agent2, float *f, void *exec_context) {
     Object *o1 = (Object *)agent1;
     Object *o2 = (Object *)agent2;
 
@@ -58,14 +68,19 @@ static void _object_interaction(void *agent1, void *agent2, void *exec_context)
     /* no overlap in y-z plane */
     if (o1->min_x > o2->max_x || o1->max_x < o2->min_x ||
         o1->min_y > o2->max_y || o1->max_y < o2->min_y)
-        return;
+        return false;
 
-    /* no overlap along x */
+    /* no overlap along x, also culled by ochre broad phase */
     if (o1->coll_min_x > o2->coll_max_x || o1->coll_max_x < o2->coll_min_x)
-        return;
+        return false;
 
     /* narrow phase */
 
+    /* second object's prisms relative to first object */
+    double dx = (double)o2->p.x - o1->p.x;
+    double dy = (double)o2->p.y - o1->p.y;
+    double dz = (double)o2->p.z - o1->p.z;
+
     double f_sum[3];
     bool interacted = false;
 
@@ -77,91 +92,188 @@ static void _object_interaction(void *agent1, void *agent2, void *exec_context)
         for (int i2 = 0; i2 < o2->prisms_count; ++i2) {
             CollPrism *p2 = o2->prisms + i2;
 
-            double f[3];
-            if (coll_interact_prisms(p1, p2, f)) {
-                f_sum[0] += f[0];
-                f_sum[1] += f[1];
-                f_sum[2] += f[2];
+            double pf[3];
+            if (coll_interact_prisms(p1, p2, dx, dy, dz, pf)) {
+                f_sum[0] += pf[0];
+                f_sum[1] += pf[1];
+                f_sum[2] += pf[2];
                 interacted = true;
             }
         }
     }
 
-    if (interacted) {
-        o1->f.x -= (float)f_sum[0];
-        o1->f.y -= (float)f_sum[1];
-        o1->f.z -= (float)f_sum[2];
-        o2->f.x += (float)f_sum[0];
-        o2->f.y += (float)f_sum[1];
-        o2->f.z += (float)f_sum[2];
-    }
+    f[0] = (float)f_sum[0];
+    f[1] = (float)f_sum[1];
+    f[2] = (float)f_sum[2];
+    return interacted;
 }
 
 /* Interaction callback that describes interaction between objects and symmetry plane. */
-static void _object_plane_interaction(void *agent, void *exec_context) {
+static bool _object_plane_interaction(void *agent, float *f, void *exec_context) {
     Object *o = (Object *)agent;
+    f[0] = f[2] = 0.0f;
     if (o->p.y < 0.0f)
-        o->f.y -= o->p.y;
+        f[1] = -o->p.y;
     else if (object_should_be_centered(o))
-        o->f.y -= o->p.y * 1.0f; // TODO: experiment and document what this factor is
+        f[1] = -o->p.y * 1.0f; // TODO: experiment and document what this factor is
+    else
+        return false;
+    return true;
 }
 
 /* Action callback where objects turn difference between their position and target
 position into force that will move them towards target position. */
-static void _object_action(void *agent, void *exec_context) {
+static bool _object_action(void *agent, float *f, void *exec_context) {
     CollContext *c = (CollContext *)exec_context;
     Object *o = (Object *)agent;
-    if (o->selected && c->dragging)
-        o->f -= o->p - o->drag_p;
+    if (!o->selected || !c->dragging)
+        return false;
+    f[0] = -(o->p.x - o->drag_p.x);
+    f[1] = -(o->p.y - o->drag_p.y);
+    f[2] = -(o->p.z - o->drag_p.z);
+    return true;
 }
 
 /* Action callback where wings turn difference between their position and target
 position into force that will move them towards target position. */
-static void _wing_action(void *agent, void *exec_context) {
+static bool _wing_action(void *agent, float *f, void *exec_context) {
     CollContext *c = (CollContext *)exec_context;
     Wing *w = (Wing *)agent;
-    if (w->selected && c->dragging) {
-        w->fx -= w->x - w->tx;
-        w->fy -= w->y - w->ty;
-        w->fz -= w->z - w->tz;
-    }
+    if (!w->selected || !c->dragging)
+        return false;
+    f[0] = -(w->x - w->tx);
+    f[1] = -(w->y - w->ty);
+    f[2] = -(w->z - w->tz);
+    return true;
 }
 
-/* Initialize ochre state for model elements collision. */
-void model_collision_init() {
-    state = ochre_add_state();
+/* Creates ochre state for model elements collision. */
+CollisionContext *model_make_collision_context() {
+    CollisionContext *c = new CollisionContext();
+    c->jobs = jobs_start();
 
-    objects_group = ochre_add_node_group(state, OFFSETOF(Object, f), OFFSETOF(Object, p), OC_LAYOUT_F32_3);
-    wings_group = ochre_add_node_group(state, OFFSETOF(Wing, fx), OFFSETOF(Wing, x), OC_LAYOUT_F32_3);
+    OcState *state = c->state = ochre_add_state();
 
-    ochre_add_node_action(state, objects_group, _object_preparation, 0);
-    ochre_add_node_interaction(state, objects_group, objects_group, _object_interaction, 1);
-    ochre_add_node_action(state, objects_group, _object_plane_interaction, 1);
-    ochre_add_node_action(state, objects_group, _object_action, 2);
+    c->objects_group = ochre_add_node_group(state, OFFSETOF(Object, f), OFFSETOF(Object, p), OC_LAYOUT_F32_3);
+    c->wings_group = ochre_add_node_group(state, OFFSETOF(Wing, fx), OFFSETOF(Wing, x), OC_LAYOUT_F32_3);
+    ochre_set_node_group_bounds(c->objects_group, OFFSETOF(Object, coll_min_x), OFFSETOF(Object, coll_max_x));
+
+    ochre_add_node_action(state, c->objects_group, _object_preparation, 0);
+    ochre_add_node_force_interaction(state, c->objects_group, c->objects_group, ochre_interaction_batch<_object_interaction>, 1);
+    ochre_add_node_force_action(state, c->objects_group, ochre_action_batch<_object_plane_interaction>, 1);
+    ochre_add_node_force_action(state, c->objects_group, ochre_action_batch<_object_action>, 2);
+
+    ochre_add_node_force_action(state, c->wings_group, ochre_action_batch<_wing_action>, 2);
+
+    CollisionSettings settings = config_default_collision_settings();
+    model_set_collision_settings(c, &settings);
+
+    return c;
+}
 
-    ochre_add_node_action(state, wings_group, _wing_action, 2);
+void model_set_collision_settings(CollisionContext *c, const CollisionSettings *settings) {
+    c->settings = *settings;
+    c->at_rest = false;
+    ochre_set_convergence(c->state, settings->tolerance, settings->max_step);
+    ochre_set_node_group_damping(c->objects_group, settings->objects_damping);
+    ochre_set_node_group_damping(c->wings_group, settings->wings_damping);
+}
+
+/* Returns true if nothing that affects collision changed since elements came to rest, in
+which case running collision would only find them at rest again. */
+static bool _still_at_rest(CollisionContext *context, Model *model, const LoftSettings *settings, bool dragging) {
+    if (!context->at_rest || dragging ||
+        context->objects_count != model->objects_count ||
+        context->wings_count != model->wings_count ||
+        context->structural_margin != settings->structural_margin)
+        return false;
+    for (int i = 0; i < model->objects_count; ++i) {
+        Object *o = model->objects[i];
+        if (o->coll_dirty || !(o->p == o->coll_p))
+            return false;
+    }
+    for (int i = 0; i < model->wings_count; ++i) {
+        Wing *w = model->wings[i];
+        if (w->coll_dirty || w->x != w->coll_x || w->y != w->coll_y || w->z != w->coll_z)
+            return false;
+    }
+    return true;
+}
+
+static void _remember_rest(CollisionContext *context, Model *model, const LoftSettings *settings) {
+    context->at_rest = true;
+    context->objects_count = model->objects_count;
+    context->wings_count = model->wings_count;
+    context->structural_margin = settings->structural_margin;
+    for (int i = 0; i < model->objects_count; ++i) {
+        Object *o = model->objects[i];
+        o->coll_dirty = false;
+        o->coll_p = o->p;
+    }
+    for (int i = 0; i < model->wings_count; ++i) {
+        Wing *w = model->wings[i];
+        w->coll_dirty = false;
+        w->coll_x = w->x;
+        w->coll_y = w->y;
+        w->coll_z = w->z;
+    }
+}
+
+void model_free_collision_context(CollisionContext *c) {
+    ochre_remove_state(c->state);
+    jobs_stop(c->jobs);
+    delete c;
 }
 
 /* Main model elements collision procedure. Returns true if some elements moved
-which would require relofting. */
-bool model_collision_run(Model *model, Arena *arena, bool dragging) {
+which would require relofting. Starts from where the previous
+run left off, and doesn't run at all if elements are known to be at rest. */
+bool model_collision_run(CollisionContext *context, Model *model, const LoftSettings *settings, bool dragging,
+                         CollisionReport *report) {
+    OcState *state = context->state;
+
+    CollisionReport r;
+    if (report == 0)
+        report = &r;
+
+    if (_still_at_rest(context, model, settings, dragging)) {
+        report->iterations = 0;
+        report->residual = 0.0f;
+        report->converged = true;
+        report->at_rest = true;
+        return false;
+    }
+
     CollContext c;
-    c.arena = arena;
+    c.structural_margin = settings->structural_margin;
     c.dragging = dragging;
 
-    arena->clear();
     ochre_set_exec_context(state, &c);
+    int workers_count = (settings->workers_count > 0) ? settings->workers_count : jobs_hardware_workers();
+    ochre_set_workers(state, context->jobs, (workers_count > JOBS_MAX_WORKERS) ? JOBS_MAX_WORKERS : workers_count);
 
     /* add elements (objects, wings) to ochre */
     ochre_clear_data(state);
     for (int i = 0; i < model->objects_count; ++i)
-        ochre_add_node(objects_group, model->objects[i]);
+        ochre_add_node(context->objects_group, model->objects[i]);
     for (int i = 0; i < model->wings_count; ++i)
-        ochre_add_node(wings_group, model->wings[i]);
+        ochre_add_node(context->wings_group, model->wings[i]);
 
     /* collide */
-    if (!ochre_run(state, 10))
+    OcReport oc_report;
+    ochre_run(state, context->settings.max_iterations, &oc_report);
+    report->iterations = oc_report.iterations;
+    report->residual = oc_report.residual;
+    report->converged = oc_report.converged;
+    report->at_rest = false;
+
+    if (oc_report.iterations == 0) { /* nothing moved */
+        if (oc_report.converged)
+            _remember_rest(context, model, settings);
+        else
+            context->at_rest = false;
         return false;
+    }
 
     /* postprocess */
     for (int i = 0; i < model->objects_count; ++i) {
@@ -171,5 +283,6 @@ bool model_collision_run(Model *model, Arena *arena, bool dragging) {
         object_update_extents(o);
     }
 
+    context->at_rest = false; /* elements moved, next run has to check they're at rest */
     return true;
 }
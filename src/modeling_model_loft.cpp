@@ -4,15 +4,205 @@
 #include "modeling_wing.h"
 #include "modeling_config.h"
 #include "util_group.h"
+#include "util_jobs.h"
 #include "memory_arena.h"
 #include <math.h>
 #include <string.h>
 
 
-static Arena verts_arena(500000);
+/* Fuselage lofted last time, identified by its elements. */
+struct _LoftedFuselage {
+    Object **objects;       /* allocated in output fuselages arena */
+    bool *is_clone;
+    int objects_count;
+    Wing **wings;
+    int wings_count;
+    int verts_beg, verts_count;
+    int panels_beg, panels_count;
+};
+
+/* Skin and fuselages it was lofted from. Model skin points into one of two outputs,
+the other one holds previous skin so unchanged fuselages can be copied from it. */
+struct _LoftOutput {
+    Arena *verts_arena;
+    Arena *mesh_arena;
+    Arena *fuselages_arena;
+    vec3 *verts;
+    Panel *panels;
+    _LoftedFuselage *fuselages;
+    int fuselages_count;
+};
+
+/* All the memory and state lofting a model needs, kept between lofts. Nothing is shared
+between contexts, so different models can be lofted at the same time, each with its own context. */
+struct LoftContext {
+    Arena *arena;           /* scratch */
+    LoftWorker workers[JOBS_MAX_WORKERS];
+    Jobs *jobs;             /* fuselage workers, kept between lofts */
+    _LoftOutput outputs[2];
+    int curr_output_i;
+    LoftSettings settings;  /* used for the last loft, everything is relofted when they change */
+    TraceCache *cache;
+};
+
+/* Lofting job for a single fuselage, remembers where in the worker's output its mesh ended up. */
+struct _LoftJob {
+    Fuselage *fuselage;
+    LoftWorker *worker;     /* worker that lofted the fuselage, 0 if it's copied from previous output */
+    int verts_beg, verts_count;
+    int panels_beg, panels_count;
+};
+
+struct _LoftJobs {
+    _LoftJob **jobs;        /* only fuselages that need relofting */
+    LoftWorker *workers;
+};
+
+LoftContext *model_make_loft_context() {
+    LoftContext *c = new LoftContext();
+    memset(c->workers, 0, sizeof(c->workers));
+    memset(&c->settings, 0, sizeof(c->settings));
+    c->arena = new Arena(4000000, ARENA_CHUNKED, "loft context");
+    c->jobs = jobs_start();
+    for (int i = 0; i < 2; ++i) {
+        _LoftOutput *o = c->outputs + i;
+        o->verts_arena = new Arena(100000, ARENA_CONTIGUOUS, "skin verts");
+        o->mesh_arena = new Arena(1000000, ARENA_CONTIGUOUS, "skin panels");
+        o->fuselages_arena = new Arena(100000, ARENA_CHUNKED, "skin fuselages");
+        o->verts = 0;
+        o->panels = 0;
+        o->fuselages = 0;
+        o->fuselages_count = 0;
+    }
+    c->curr_output_i = 0;
+    c->cache = mesh_trace_cache_make();
+    return c;
+}
+
+void model_free_loft_context(LoftContext *c) {
+    for (int i = 0; i < JOBS_MAX_WORKERS; ++i) {
+        LoftWorker *w = c->workers + i;
+        delete w->arena;
+        delete w->verts_arena;
+        delete w->mesh_arena;
+        delete w->mesh_envs_arena;
+        jobs_stop(w->station_jobs);
+        for (int j = 0; j < JOBS_MAX_WORKERS; ++j)
+            delete w->env_arenas[j];
+    }
+    for (int i = 0; i < 2; ++i) {
+        delete c->outputs[i].verts_arena;
+        delete c->outputs[i].mesh_arena;
+        delete c->outputs[i].fuselages_arena;
+    }
+    mesh_trace_cache_free(c->cache);
+    jobs_stop(c->jobs);
+    delete c->arena;
+    delete c;
+}
+
+/* Creates worker memory on first use and resets its output. */
+static void _init_worker(LoftWorker *w, Model *model, LoftContext *context, int station_workers_count) {
+    if (w->arena == 0) {
+        w->arena = new Arena(4000000, ARENA_CHUNKED, "loft");
+        w->verts_arena = new Arena(100000, ARENA_CONTIGUOUS, "loft verts");
+        w->mesh_arena = new Arena(1000000, ARENA_CONTIGUOUS, "loft panels");
+        w->mesh_envs_arena = new Arena(100000, ARENA_CHUNKED, "mesh envelopes");
+        w->station_jobs = jobs_start();
+    }
+    for (int i = 0; i < station_workers_count; ++i)
+        if (w->env_arenas[i] == 0)
+            w->env_arenas[i] = new Arena(200000, ARENA_CHUNKED, "trace");
+    w->station_workers_count = station_workers_count;
+    w->verts_arena->clear();
+    w->mesh_arena->clear();
+    w->verts_count = 0;
+    w->panels_count = 0;
+    memset(&w->trace_stats, 0, sizeof(w->trace_stats));
+    w->cache = context->cache;
+    w->settings = &context->settings;
+    w->model = model;
+}
+
+static void _loft_job(void *data, int job_i, int worker_i) {
+    _LoftJobs *jobs = (_LoftJobs *)data;
+    _LoftJob *job = jobs->jobs[job_i];
+    LoftWorker *w = jobs->workers + worker_i;
+    Fuselage *f = job->fuselage;
+
+    job->verts_beg = w->verts_count;
+    job->panels_beg = w->panels_count;
+
+    w->arena->clear();
+    fuselage_update_conns(w->arena, f);
+    fuselage_update_longitudinal_tangents(f);
+    w->arena->clear();
+    fuselage_loft(w, f);
+
+    job->worker = w;
+    job->verts_count = w->verts_count - job->verts_beg;
+    job->panels_count = w->panels_count - job->panels_beg;
+}
+
+static int _rebase_index(int i, int from, int to) {
+    return (i < 0) ? i : i - from + to;
+}
+
+/* Returns true if settings affecting the skin changed since last loft. Worker count doesn't
+change the skin. */
+static bool _update_lofted_settings(LoftSettings *lofted, const LoftSettings *settings) {
+    bool changed = lofted->longitudinal_smoothness != settings->longitudinal_smoothness ||
+                   lofted->shape_curve_samples != settings->shape_curve_samples ||
+                   lofted->structural_margin != settings->structural_margin ||
+                   lofted->one_side_merge_delay != settings->one_side_merge_delay ||
+                   lofted->two_side_merge_delay != settings->two_side_merge_delay ||
+                   lofted->collapse_margin != settings->collapse_margin ||
+                   lofted->exact_tracing != settings->exact_tracing;
+    *lofted = *settings;
+    return changed;
+}
+
+static void _init_lofted_fuselage(Arena *arena, _LoftedFuselage *l, Fuselage *f) {
+    l->objects = arena->alloc<Object *>(f->orefs_count);
+    l->is_clone = arena->alloc<bool>(f->orefs_count);
+    l->wings = arena->alloc<Wing *>(f->wrefs_count);
+    l->objects_count = f->orefs_count;
+    for (int i = 0; i < f->orefs_count; ++i) {
+        l->objects[i] = f->orefs[i].object;
+        l->is_clone[i] = f->orefs[i].is_clone;
+    }
+    l->wings_count = f->wrefs_count;
+    for (int i = 0; i < f->wrefs_count; ++i)
+        l->wings[i] = f->wrefs[i].wing;
+}
+
+/* Returns previously lofted fuselage with the same elements if none of them changed since. */
+static _LoftedFuselage *_find_unchanged_fuselage(_LoftOutput *output, Fuselage *f) {
+    for (int i = 0; i < f->orefs_count; ++i)
+        if (object_loft_dirty(f->orefs[i].object))
+            return 0;
+    for (int i = 0; i < f->wrefs_count; ++i)
+        if (wing_loft_dirty(f->wrefs[i].wing))
+            return 0;
+
+    for (int i = 0; i < output->fuselages_count; ++i) {
+        _LoftedFuselage *l = output->fuselages + i;
+        if (l->objects_count != f->orefs_count || l->wings_count != f->wrefs_count)
+            continue;
+        bool same = true;
+        for (int j = 0; j < f->orefs_count && same; ++j)
+            same = l->objects[j] == f->orefs[j].object && l->is_clone[j] == f->orefs[j].is_clone;
+        for (int j = 0; j < f->wrefs_count && same; ++j)
+            same = l->wings[j] == f->wrefs[j].wing;
+        if (same)
+            return l;
+    }
+
+    return 0;
+}
 
 /* Initializes an Objref instance. */
-static void _init_oref(Oref *r, Object *o, int index, bool is_clone) {
+static void _init_oref(Oref *r, Object *o, int index, bool is_clone, double structural_margin) {
     memset(r, 0, sizeof(Oref));
     r->object = o;
     r->is_clone = is_clone;
@@ -21,13 +211,13 @@ static void _init_oref(Oref *r, Object *o, int index, bool is_clone) {
     r->z = (double)o->p.z;
     if (r->is_clone) {
         r->y = -(double)o->p.y;
-        shape_mirror_former(&o->def.t_skin_former, &r->t_skin_former, r->x, r->y, r->z, STRUCTURAL_MARGIN);
-        shape_mirror_former(&o->def.n_skin_former, &r->n_skin_former, r->x, r->y, r->z, STRUCTURAL_MARGIN);
+        shape_mirror_former(&o->def.t_skin_former, &r->t_skin_former, r->x, r->y, r->z, structural_margin);
+        shape_mirror_former(&o->def.n_skin_former, &r->n_skin_former, r->x, r->y, r->z, structural_margin);
     }
     else {
         r->y = (double)o->p.y;
-        shape_copy_former(&o->def.t_skin_former, &r->t_skin_former, r->x, r->y, r->z, STRUCTURAL_MARGIN);
-        shape_copy_former(&o->def.n_skin_former, &r->n_skin_former, r->x, r->y, r->z, STRUCTURAL_MARGIN);
+        shape_copy_former(&o->def.t_skin_former, &r->t_skin_former, r->x, r->y, r->z, structural_margin);
+        shape_copy_former(&o->def.n_skin_former, &r->n_skin_former, r->x, r->y, r->z, structural_margin);
     }
 }
 
@@ -36,15 +226,20 @@ static void _init_wref(Wref *wref, Wing *w, int index, bool is_clone) {
     wref->is_clone = is_clone;
 }
 
-/* Main loft function. */
-void model_loft(Arena *arena, Model *model) {
+/* Main loft function. Lofts model with given settings using memory from context, which
+must not be used by another loft at the same time. */
+void model_loft(LoftContext *context, Model *model, const LoftSettings *settings, LoftReport *report) {
+    LoftReport r;
+    if (report == 0)
+        report = &r;
+    memset(report, 0, sizeof(LoftReport));
+
     if (model->objects_count == 0) /* if model has no objects we're done */
         return;
 
+    Arena *arena = context->arena;
     arena->clear();
 
-    static Fuselage fuselages[MAX_FUSELAGES];
-    int fuselages_count = 0;
     int available_ref_index = 0;
 
     /* create object references from model objects, including clones */
@@ -54,10 +249,10 @@ void model_loft(Arena *arena, Model *model) {
     for (int i = 0; i < model->objects_count; ++i) {
         Object *o = model->objects[i];
         Oref *oref = orefs + orefs_count++;
-        _init_oref(oref, o, available_ref_index, false);
+        _init_oref(oref, o, available_ref_index, false, settings->structural_margin);
         if (object_should_be_mirrored(o)) {
             Oref *c_ref = orefs + orefs_count++;
-            _init_oref(c_ref, o, available_ref_index, true);
+            _init_oref(c_ref, o, available_ref_index, true, settings->structural_margin);
         }
         ++available_ref_index;
     }
@@ -79,13 +274,20 @@ void model_loft(Arena *arena, Model *model) {
 
     /* group object references into fuselages */
 
-    static GroupMaker maker;
-    group_objects(sizeof(Oref), orefs, orefs_count, (GROUP_FUNC)fuselage_objects_overlap, &maker);
+    GroupMaker maker;
+    group_objects(arena, sizeof(Oref), orefs, orefs_count, (GROUP_FUNC)fuselage_objects_overlap,
+                  (GROUP_BOUNDS_FUNC)fuselage_object_bounds, &maker);
+
+    Fuselage *fuselages = arena->alloc<Fuselage>(maker.count);
+    int fuselages_count = 0;
     for (int i = 0; i < maker.count; ++i) {
         Group *g = maker.groups + i;
         Fuselage *f = fuselages + fuselages_count++;
+        f->orefs = arena->alloc<Oref>(g->count);
         f->orefs_count = g->count;
+        f->wrefs = 0;
         f->wrefs_count = 0;
+        f->conns = arena->alloc<Conn>(MAX_FUSELAGE_CONNS(g->count));
         f->conns_count = 0;
         for (int j = 0; j < g->count; ++j)
             f->orefs[j] = orefs[g->obj_indices[j]];
@@ -93,14 +295,17 @@ void model_loft(Arena *arena, Model *model) {
 
     /* add wings to fuselages */
 
+    int *wref_fuselages = arena->alloc<int>(wrefs_count); /* fuselage index for each wing reference, -1 if none */
     for (int i = 0; i < wrefs_count; ++i) {
         Wref *wref = wrefs + i;
+        wref_fuselages[i] = -1;
         for (int j = 0; j < fuselages_count; ++j) {
             Fuselage *f = fuselages + j;
             for (int k = 0; k < f->orefs_count; ++k) {
                 Oref *oref = f->orefs + k;
                 if (fuselage_object_and_wing_overlap(oref, wref)) {
-                    f->wrefs[f->wrefs_count++] = *wref;
+                    wref_fuselages[i] = j;
+                    ++f->wrefs_count;
                     goto FUSELAGE_FOR_WING_FOUND;
                 }
             }
@@ -108,19 +313,137 @@ void model_loft(Arena *arena, Model *model) {
         FUSELAGE_FOR_WING_FOUND:;
     }
 
-    /* generate skin panels */
+    for (int i = 0; i < fuselages_count; ++i) {
+        Fuselage *f = fuselages + i;
+        f->wrefs = arena->alloc<Wref>(f->wrefs_count);
+        f->wrefs_count = 0;
+    }
+    for (int i = 0; i < wrefs_count; ++i)
+        if (wref_fuselages[i] != -1) {
+            Fuselage *f = fuselages + wref_fuselages[i];
+            f->wrefs[f->wrefs_count++] = wrefs[i];
+        }
 
-    verts_arena.clear();
-    model->skin_verts = verts_arena.rest<vec3>();
-    model->skin_verts_count = 0;
-    mesh_init(model);
+    /* find fuselages that didn't change since last loft */
+
+    _LoftOutput *prev_output = context->outputs + context->curr_output_i;
+    context->curr_output_i = 1 - context->curr_output_i;
+    _LoftOutput *output = context->outputs + context->curr_output_i;
+
+    if (_update_lofted_settings(&context->settings, settings)) /* everything changes */
+        prev_output->fuselages_count = 0;
+
+    _LoftJob *fuselage_jobs = arena->alloc<_LoftJob>(fuselages_count);
+    _LoftJobs jobs;
+    jobs.jobs = arena->alloc<_LoftJob *>(fuselages_count);
+    jobs.workers = context->workers;
+    int jobs_count = 0;
 
     for (int i = 0; i < fuselages_count; ++i) {
-        Fuselage *f = fuselages + i;
-        arena->clear();
-        fuselage_update_conns(arena, f);
-        fuselage_update_longitudinal_tangents(f);
-        arena->clear();
-        fuselage_loft(arena, &verts_arena, model, f);
+        _LoftJob *job = fuselage_jobs + i;
+        job->fuselage = fuselages + i;
+
+        _LoftedFuselage *lofted = _find_unchanged_fuselage(prev_output, job->fuselage);
+        if (lofted) {
+            job->worker = 0;
+            job->verts_beg = lofted->verts_beg;
+            job->verts_count = lofted->verts_count;
+            job->panels_beg = lofted->panels_beg;
+            job->panels_count = lofted->panels_count;
+        }
+        else
+            jobs.jobs[jobs_count++] = job;
+    }
+
+    /* loft changed fuselages, each one on a single worker */
+
+    if (jobs_count > 0) {
+        int threads_count = (settings->workers_count > 0) ? settings->workers_count : jobs_hardware_workers();
+        if (threads_count > JOBS_MAX_WORKERS)
+            threads_count = JOBS_MAX_WORKERS;
+        int workers_count = threads_count;
+        if (workers_count > jobs_count)
+            workers_count = jobs_count;
+        int station_workers_count = threads_count / workers_count; /* threads left over are used to trace stations */
+        for (int i = 0; i < workers_count; ++i)
+            _init_worker(context->workers + i, model, context, station_workers_count);
+
+#if DRAW_CORRS
+        mesh_init(model);
+#endif
+        mesh_trace_cache_begin(context->cache);
+
+        jobs_run(context->jobs, _loft_job, &jobs, jobs_count, workers_count);
+
+        report->fuselages = jobs_count;
+        for (int i = 0; i < workers_count; ++i) {
+            TraceStats *s = &context->workers[i].trace_stats;
+            report->traces.traced += s->traced;
+            report->traces.retried += s->retried;
+            report->traces.retries += s->retries;
+            report->traces.failed += s->failed;
+        }
+    }
+
+    /* concatenate fuselage meshes in fuselage order so the mesh doesn't depend on scheduling */
+
+    int skin_verts_count = 0;
+    int skin_panels_count = 0;
+    for (int i = 0; i < fuselages_count; ++i) {
+        skin_verts_count += fuselage_jobs[i].verts_count;
+        skin_panels_count += fuselage_jobs[i].panels_count;
     }
+
+    output->verts_arena->clear();
+    output->mesh_arena->clear();
+    output->fuselages_arena->clear();
+    output->fuselages = output->fuselages_arena->alloc<_LoftedFuselage>(fuselages_count);
+    output->fuselages_count = 0;
+    output->verts = output->verts_arena->alloc<vec3>(skin_verts_count);
+    output->panels = output->mesh_arena->alloc<Panel>(skin_panels_count);
+    skin_verts_count = 0;
+    skin_panels_count = 0;
+
+    for (int i = 0; i < fuselages_count; ++i) {
+        _LoftJob *job = fuselage_jobs + i;
+
+        _LoftedFuselage *lofted = output->fuselages + output->fuselages_count++;
+        _init_lofted_fuselage(output->fuselages_arena, lofted, job->fuselage);
+        lofted->verts_beg = skin_verts_count;
+        lofted->verts_count = job->verts_count;
+        lofted->panels_beg = skin_panels_count;
+        lofted->panels_count = job->panels_count;
+
+        vec3 *src_verts = job->worker ? job->worker->verts_arena->base<vec3>() : prev_output->verts;
+        Panel *src_panels = job->worker ? job->worker->mesh_arena->base<Panel>() : prev_output->panels;
+
+        memcpy(output->verts + skin_verts_count, src_verts + job->verts_beg, sizeof(vec3) * job->verts_count);
+
+        Panel *panels = output->panels + skin_panels_count;
+        for (int j = 0; j < job->panels_count; ++j) {
+            Panel *p = panels + j;
+            *p = src_panels[job->panels_beg + j];
+            p->v1 = _rebase_index(p->v1, job->verts_beg, skin_verts_count);
+            p->v2 = _rebase_index(p->v2, job->verts_beg, skin_verts_count);
+            p->v3 = _rebase_index(p->v3, job->verts_beg, skin_verts_count);
+            p->v4 = _rebase_index(p->v4, job->verts_beg, skin_verts_count);
+            p->prev = _rebase_index(p->prev, job->panels_beg, skin_panels_count);
+            p->next = _rebase_index(p->next, job->panels_beg, skin_panels_count);
+            p->tail = _rebase_index(p->tail, job->panels_beg, skin_panels_count);
+            p->nose = _rebase_index(p->nose, job->panels_beg, skin_panels_count);
+        }
+
+        skin_verts_count += job->verts_count;
+        skin_panels_count += job->panels_count;
+    }
+
+    model->skin_verts = output->verts;
+    model->skin_verts_count = skin_verts_count;
+    model->panels = output->panels;
+    model->panels_count = skin_panels_count;
+
+    for (int i = 0; i < model->objects_count; ++i)
+        object_loft_clean(model->objects[i]);
+    for (int i = 0; i < model->wings_count; ++i)
+        wing_loft_clean(model->wings[i]);
 }
@@ -1,13 +1,21 @@
 #include "modeling_model.h"
 #include "modeling_object.h"
+#include "math_vec.h"
+#include "math_math.h"
 #include "serial.h"
 #include "platform.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 
+/* Largest dump, a model with as many objects as it can have, each with all its formers. Serial
+asserts one byte of room is always left. */
+#define _FORMER_BYTES   (sizeof(float) + SHAPE_CURVES * 3 * sizeof(double))
+#define _OBJECT_BYTES   (3 * sizeof(float) + sizeof(int) + (MAX_OBJECT_FORMERS + 2) * _FORMER_BYTES + 2 * sizeof(float))
+#define _MAX_DUMP_BYTES (int)(sizeof(int) + MAX_ELEMS * _OBJECT_BYTES + 1)
 
-Serial file = serial_make((char *)malloc(10000), 10000);
+
+Serial file = serial_make((char *)malloc(_MAX_DUMP_BYTES), _MAX_DUMP_BYTES);
 
 static void _serialize_former(Former *former) {
     serial_write_f32(&file, &former->x, 1); /* former position */
@@ -99,3 +107,34 @@ void model_serial_dump_mesh(Model *model, const char *path) {
 
     fclose(file);
 }
+
+/* Binary version of the above: vertex and panel counts, followed by vertex coordinates (3 x f32)
+and panel vertex indices (4 x i32). Panel indices are packed and written in chunks. */
+void model_serial_dump_mesh_binary(Model *model, const char *path) {
+    const int _CHUNK_PANELS = 1024;
+
+    FILE *file = (FILE *)platform_fopen(path, "wb");
+
+    int counts[2] = { model->skin_verts_count, model->panels_count };
+    fwrite(counts, sizeof(int), 2, file);
+
+    /* vertices */
+    fwrite(model->skin_verts, sizeof(vec3), model->skin_verts_count, file);
+
+    /* panels */
+    int chunk[_CHUNK_PANELS * 4];
+    for (int i = 0; i < model->panels_count; i += _CHUNK_PANELS) {
+        int count = min_i(model->panels_count - i, _CHUNK_PANELS);
+        int *c = chunk;
+        for (int j = 0; j < count; ++j) {
+            Panel *p = model->panels + i + j;
+            *c++ = p->v1;
+            *c++ = p->v2;
+            *c++ = p->v3;
+            *c++ = p->v4;
+        }
+        fwrite(chunk, sizeof(int), count * 4, file);
+    }
+
+    fclose(file);
+}
@@ -4,6 +4,9 @@
 
 void object_finish(Object *o) {
     o->selected = false;
+    o->loft_dirty = true;
+    o->coll_dirty = true;
+    o->prisms_dirty = true;
     object_reset_drag_p(o);
     object_update_extents(o);
 }
@@ -47,3 +50,13 @@ void object_move(Object *o, vec3 dp) {
 void object_reset_drag_p(Object *o) {
     o->drag_p = o->p;
 }
+
+/* Returns true if object changed in a way that affects its skin since it was last lofted. */
+bool object_loft_dirty(Object *o) {
+    return o->loft_dirty || !(o->p == o->loft_p);
+}
+
+void object_loft_clean(Object *o) {
+    o->loft_dirty = false;
+    o->loft_p = o->p;
+}
@@ -4,6 +4,7 @@
 #include "math_vec.h"
 #include "modeling_shape.h"
 #include "modeling_constants.h"
+#include "modeling_collision.h"
 
 #define MAX_OBJECT_FORMERS      8
 #define MAX_SKIN_FORMERS        4
@@ -26,16 +27,24 @@ struct Object {
 
     /* collision */
     vec3 f;
-    struct CollPrism *prisms; /* allocated in arena */
+    CollPrism prisms[MAX_OBJECT_FORMERS]; /* object CS, rebuilt when definition or margin changes */
     int prisms_count;
+    bool prisms_dirty;    /* definition changed since prisms were built */
+    double prisms_margin; /* margin prisms were built with */
     float min_x, max_x; /* model CS */
     float min_y, max_y; /* model CS, collision formers */
     float min_z, max_z; /* model CS, collision formers */
     float coll_min_x, coll_max_x; /* with refs */
+    bool coll_dirty; /* definition changed since collision came to rest */
+    vec3 coll_p;     /* position when collision came to rest */
 
     /* control */
     bool selected;
     vec3 drag_p;
+
+    /* loft */
+    bool loft_dirty; /* definition changed since last lofted */
+    vec3 loft_p;     /* position when last lofted */
 };
 
 void object_move(Object *o, vec3 dp);
@@ -44,5 +53,7 @@ void object_finish(Object *o);
 void object_update_extents(Object *o);
 bool object_should_be_centered(Object *o);
 bool object_should_be_mirrored(Object *o);
+bool object_loft_dirty(Object *o);
+void object_loft_clean(Object *o);
 
 #endif
@@ -1,61 +1,26 @@
 #include "modeling_ochre.h"
 #include "math_vec.h"
+#include "util_jobs.h"
 #include <float.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
 
-const int MAX_STATES      = 8;
 const int MAX_GROUPS      = 32;
 const int MAX_PHASES      = 32;
 const int MAX_HANDLERS    = 32;
 const int NULL_OFFSET     = 102400;
+const int PAIRS_PER_JOB   = 64;
+const int MIN_PARALLEL_PAIRS = 256; /* fewer pairs are calculated quicker on the calling thread than handed to workers */
 
 struct _f32_2 {
     float x, y;
-
-    void zero() {
-        x = y = 0.0f;
-    }
-
-    float length() {
-        return sqrtf(x * x + y * y);
-    }
-
-    void scale(float s) {
-        x *= s;
-        y *= s;
-    }
-
-    void increase(_f32_2 *o) {
-        x += o->x;
-        y += o->y;
-    }
 };
 
 struct _f32_3 {
     float x, y, z;
-
-    void zero() {
-        x = y = z = 0.0f;
-    }
-
-    float length() {
-        return sqrtf(x * x + y * y + z * z);
-    }
-
-    void scale(float s) {
-        x *= s;
-        y *= s;
-        z *= s;
-    }
-
-    void increase(_f32_3 *o) {
-        x += o->x;
-        y += o->y;
-        z += o->z;
-    }
 };
 
 struct _Group {
@@ -63,6 +28,7 @@ struct _Group {
     void **agents;
 
     _Group() : count(0), cap(0), agents(0) {}
+    ~_Group() { free(agents); }
 
     void clear() {
         count = 0;
@@ -81,73 +47,157 @@ struct _Group {
     }
 };
 
+/* Node group keeps forces of its agents in its own arrays while running, so force
+bookkeeping doesn't have to go through agent pointers and loops over forces can be
+vectorized. Agents' forces are only synced when a handler that writes them directly
+runs and when the run is done, positions are written to agents every iteration since
+handlers read them. */
 struct OcNodeGroup : _Group {
     unsigned f_offset;
     unsigned p_offset;
     OcLayout layout;
+    unsigned min_offset;    /* bounds along broad phase axis, NULL_OFFSET if not registered */
+    unsigned max_offset;
+    float *fx, *fy, *fz;    /* agent forces while running */
+    int forces_cap;
+    float damping;          /* scales normalized forces before they're applied */
+
+    OcNodeGroup() : fx(0), fy(0), fz(0), forces_cap(0), damping(1.0f) {}
+
+    ~OcNodeGroup() {
+        free(fx);
+        free(fy);
+        free(fz);
+    }
+
+    bool has_bounds() {
+        return min_offset != NULL_OFFSET;
+    }
+
+    bool has_forces() {
+        return f_offset != NULL_OFFSET;
+    }
+
+    float get_bound(int i, unsigned offset) {
+        return *(float *)((char *)agents[i] + offset);
+    }
 
     void reset_force() {
-        if (f_offset == NULL_OFFSET)
+        if (!has_forces())
+            return;
+        if (count > forces_cap) {
+            forces_cap = count + 256;
+            fx = (float *)realloc(fx, sizeof(float) * forces_cap);
+            fy = (float *)realloc(fy, sizeof(float) * forces_cap);
+            fz = (float *)realloc(fz, sizeof(float) * forces_cap);
+        }
+        memset(fx, 0, sizeof(float) * count);
+        memset(fy, 0, sizeof(float) * count);
+        memset(fz, 0, sizeof(float) * count);
+    }
+
+    /* Copies forces from group to agents. */
+    void scatter_force() {
+        if (!has_forces())
             return;
         if (layout == OC_LAYOUT_F32_2) {
-            for (int i = 0; i < count; ++i)
-                ((_f32_2 *)((char *)agents[i] + f_offset))->zero();
+            for (int i = 0; i < count; ++i) {
+                _f32_2 *f = (_f32_2 *)((char *)agents[i] + f_offset);
+                f->x = fx[i];
+                f->y = fy[i];
+            }
         }
         else if (layout == OC_LAYOUT_F32_3) {
-            for (int i = 0; i < count; ++i)
-                ((_f32_3 *)((char *)agents[i] + f_offset))->zero();
+            for (int i = 0; i < count; ++i) {
+                _f32_3 *f = (_f32_3 *)((char *)agents[i] + f_offset);
+                f->x = fx[i];
+                f->y = fy[i];
+                f->z = fz[i];
+            }
         }
         else
             assert(false); /* unhandled layout */
     }
 
-    float get_max_force(float max_f) {
-        if (f_offset == NULL_OFFSET)
-            return max_f;
+    /* Copies forces from agents to group. */
+    void gather_force() {
+        if (!has_forces())
+            return;
         if (layout == OC_LAYOUT_F32_2) {
             for (int i = 0; i < count; ++i) {
-                float f = ((_f32_2 *)((char *)agents[i] + f_offset))->length();
-                if (f > max_f)
-                    max_f = f;
+                _f32_2 *f = (_f32_2 *)((char *)agents[i] + f_offset);
+                fx[i] = f->x;
+                fy[i] = f->y;
             }
         }
         else if (layout == OC_LAYOUT_F32_3) {
             for (int i = 0; i < count; ++i) {
-                float f = ((_f32_3 *)((char *)agents[i] + f_offset))->length();
-                if (f > max_f)
-                    max_f = f;
+                _f32_3 *f = (_f32_3 *)((char *)agents[i] + f_offset);
+                fx[i] = f->x;
+                fy[i] = f->y;
+                fz[i] = f->z;
             }
         }
         else
             assert(false); /* unhandled layout */
-        return max_f;
     }
 
-    void normalize_force(float f_normalizer) {
-        if (f_offset == NULL_OFFSET)
-            return;
+    /* Square root is monotonic, so the longest force is found by comparing squared lengths. */
+    float get_max_force(float max_f) {
+        if (!has_forces())
+            return max_f;
+        float max_f2 = 0.0f;
         if (layout == OC_LAYOUT_F32_2) {
-            for (int i = 0; i < count; ++i)
-                ((_f32_2 *)((char *)agents[i] + f_offset))->scale(f_normalizer);
+            for (int i = 0; i < count; ++i) {
+                float f2 = fx[i] * fx[i] + fy[i] * fy[i];
+                max_f2 = (f2 > max_f2) ? f2 : max_f2;
+            }
         }
         else if (layout == OC_LAYOUT_F32_3) {
-            for (int i = 0; i < count; ++i)
-                ((_f32_3 *)((char *)agents[i] + f_offset))->scale(f_normalizer);
+            for (int i = 0; i < count; ++i) {
+                float f2 = fx[i] * fx[i] + fy[i] * fy[i] + fz[i] * fz[i];
+                max_f2 = (f2 > max_f2) ? f2 : max_f2;
+            }
         }
         else
             assert(false); /* unhandled layout */
+        float f = sqrtf(max_f2);
+        return (f > max_f) ? f : max_f;
+    }
+
+    /* Adds sign * f to force of agent i. */
+    void add_force(int i, float *f, float sign) {
+        if (!has_forces())
+            return;
+        fx[i] += sign * f[0];
+        fy[i] += sign * f[1];
+        if (layout == OC_LAYOUT_F32_3)
+            fz[i] += sign * f[2];
     }
 
-    void apply_force() {
-        if (f_offset == NULL_OFFSET)
+    /* Scales forces and moves agents by them. */
+    void apply_force(float f_normalizer) {
+        if (!has_forces())
             return;
+        for (int i = 0; i < count; ++i) {
+            fx[i] *= f_normalizer;
+            fy[i] *= f_normalizer;
+            fz[i] *= f_normalizer;
+        }
         if (layout == OC_LAYOUT_F32_2) {
-            for (int i = 0; i < count; ++i)
-                ((_f32_2 *)((char *)agents[i] + p_offset))->increase(((_f32_2 *)((char *)agents[i] + f_offset)));
+            for (int i = 0; i < count; ++i) {
+                _f32_2 *p = (_f32_2 *)((char *)agents[i] + p_offset);
+                p->x += fx[i];
+                p->y += fy[i];
+            }
         }
         else if (layout == OC_LAYOUT_F32_3) {
-            for (int i = 0; i < count; ++i)
-                ((_f32_3 *)((char *)agents[i] + p_offset))->increase(((_f32_3 *)((char *)agents[i] + f_offset)));
+            for (int i = 0; i < count; ++i) {
+                _f32_3 *p = (_f32_3 *)((char *)agents[i] + p_offset);
+                p->x += fx[i];
+                p->y += fy[i];
+                p->z += fz[i];
+            }
         }
         else
             assert(false); /* unhandled layout */
@@ -156,7 +206,56 @@ struct OcNodeGroup : _Group {
 
 struct OcLinkGroup : _Group {};
 
-enum _HandlerType { NODE, NODE_NODE, LINK, LINK_LINK, LINK_NODE };
+enum _HandlerType { NODE, NODE_FORCE, NODE_NODE, NODE_NODE_FORCE, LINK, LINK_LINK, LINK_NODE };
+
+/* Bounds of an agent along broad phase axis. */
+struct _Bound {
+    float min, max;
+    int index;
+    int group_i;    /* which of the two interacting groups the agent is in */
+};
+
+
+static int _compare_bounds(const void *a, const void *b) {
+    const _Bound *b1 = (const _Bound *)a;
+    const _Bound *b2 = (const _Bound *)b;
+    if (b1->min != b2->min)
+        return (b1->min < b2->min) ? -1 : 1;
+    if (b1->group_i != b2->group_i)
+        return b1->group_i - b2->group_i;
+    return b1->index - b2->index;
+}
+
+/* Broad phase pairs found for a handler and agent bounds they were found with. While dragging
+usually only the dragged agent moves, so only its pairs have to be found again. */
+struct _PairCache {
+    void **agents;      /* of both groups, second group's agents follow the first one's unless it's the same group */
+    float *mins, *maxs;
+    bool *moved;
+    int count1;         /* agents in the first group */
+    int agents_count, agents_cap; /* -1 when there are no cached pairs */
+    OcPair *pairs;
+    int pairs_count, pairs_cap;
+
+    _PairCache() : agents(0), mins(0), maxs(0), moved(0), count1(0), agents_count(-1), agents_cap(0),
+                   pairs(0), pairs_count(0), pairs_cap(0) {}
+
+    ~_PairCache() {
+        free(agents);
+        free(mins);
+        free(maxs);
+        free(moved);
+        free(pairs);
+    }
+};
+
+static int _compare_pairs(const void *a, const void *b) {
+    const OcPair *p1 = (const OcPair *)a;
+    const OcPair *p2 = (const OcPair *)b;
+    if (p1->i1 != p2->i1)
+        return p1->i1 - p2->i1;
+    return p1->i2 - p2->i2;
+}
 
 struct _Handler {
     _HandlerType type;
@@ -167,10 +266,18 @@ struct _Handler {
             OcNodeGroup *group;
             VPTR_FUNC func;
         } node_act;
+        struct {
+            OcNodeGroup *group;
+            OC_ACTION_BATCH func;
+        } node_force_act;
         struct {
             OcNodeGroup *group1, *group2;
             VPTR_VPTR_FUNC func;
         } node_interact;
+        struct {
+            OcNodeGroup *group1, *group2;
+            OC_INTERACTION_BATCH func;
+        } node_force_interact;
         struct {
             OcLinkGroup *group;
             VPTR_FUNC func;
@@ -196,14 +303,37 @@ struct OcState {
     _Handler handlers[MAX_HANDLERS];
     int handlers_count;
     void *exec_context;
-
-    OcState() : node_groups_count(0), link_groups_count(0), handlers_count(0), exec_context(0) {}
+    _Bound *bounds;     /* broad phase scratch */
+    int bounds_cap;
+    _PairCache pair_caches[MAX_HANDLERS]; /* per handler */
+    OcPair *pairs;
+    OcForce *pair_forces;
+    int pairs_count, pairs_cap;
+    OcForce *forces;    /* force action scratch */
+    int forces_cap;
+    Jobs *jobs;         /* owned by whoever sets workers */
+    int workers_count;
+    double tolerance;   /* run converged when no force is larger */
+    float max_step;     /* forces larger than this are scaled down to it */
+
+    OcState() : node_groups_count(0), link_groups_count(0), handlers_count(0), exec_context(0),
+                bounds(0), bounds_cap(0), pairs(0), pair_forces(0), pairs_count(0), pairs_cap(0),
+                forces(0), forces_cap(0), jobs(0), workers_count(1), tolerance(0.01), max_step(0.5f) {}
+
+    ~OcState() {
+        free(bounds);
+        free(pairs);
+        free(pair_forces);
+        free(forces);
+    }
 
     void clear() {
         clear_data();
         node_groups_count = 0;
         link_groups_count = 0;
         handlers_count = 0;
+        for (int i = 0; i < MAX_HANDLERS; ++i)
+            pair_caches[i].agents_count = -1;
     }
 
     void clear_data() {
@@ -219,6 +349,8 @@ struct OcState {
         group->f_offset = f_offset;
         group->p_offset = p_offset;
         group->layout = layout;
+        group->min_offset = NULL_OFFSET;
+        group->max_offset = NULL_OFFSET;
         return group;
     }
 
@@ -241,6 +373,15 @@ struct OcState {
         h.node_act.func = func;
     }
 
+    void add_node_force_act(OcNodeGroup *node_group, OC_ACTION_BATCH func, unsigned phase) {
+        assert(handlers_count < MAX_HANDLERS - 1);
+        _Handler &h = handlers[handlers_count++];
+        h.type = NODE_FORCE;
+        h.phase = phase;
+        h.node_force_act.group = node_group;
+        h.node_force_act.func = func;
+    }
+
     void add_node_interact(OcNodeGroup *node_group1, OcNodeGroup *node_group2, VPTR_VPTR_FUNC func, unsigned phase) {
         assert(handlers_count < MAX_HANDLERS - 1);
         _Handler &h = handlers[handlers_count++];
@@ -251,6 +392,16 @@ struct OcState {
         h.node_interact.func = func;
     }
 
+    void add_node_force_interact(OcNodeGroup *node_group1, OcNodeGroup *node_group2, OC_INTERACTION_BATCH func, unsigned phase) {
+        assert(handlers_count < MAX_HANDLERS - 1);
+        _Handler &h = handlers[handlers_count++];
+        h.type = NODE_NODE_FORCE;
+        h.phase = phase;
+        h.node_force_interact.group1 = node_group1;
+        h.node_force_interact.group2 = node_group2;
+        h.node_force_interact.func = func;
+    }
+
     void add_link_act(OcLinkGroup *link_group, VPTR_FUNC func, unsigned phase) {
         assert(handlers_count < MAX_HANDLERS - 1);
         _Handler &h = handlers[handlers_count++];
@@ -280,7 +431,208 @@ struct OcState {
         h.link_node_interact.func = func;
     }
 
-    bool run(int iterations) {
+    void add_pair(int i1, int i2) {
+        if (pairs_count == pairs_cap) {
+            pairs_cap = pairs_cap * 2 + 256;
+            pairs = (OcPair *)realloc(pairs, sizeof(OcPair) * pairs_cap);
+            pair_forces = (OcForce *)realloc(pair_forces, sizeof(OcForce) * pairs_cap);
+        }
+        OcPair *p = pairs + pairs_count++;
+        p->i1 = i1;
+        p->i2 = i2;
+    }
+
+    int add_bounds(OcNodeGroup *group, int group_i, int bounds_count) {
+        for (int i = 0; i < group->count; ++i) {
+            _Bound *b = bounds + bounds_count++;
+            b->min = group->get_bound(i, group->min_offset);
+            b->max = group->get_bound(i, group->max_offset);
+            b->index = i;
+            b->group_i = group_i;
+        }
+        return bounds_count;
+    }
+
+    /* Sweep and prune, finds pairs of agents from two groups (or the same group) whose bounds
+    overlap. Pairs are sorted the same way the full double loop visits them, so forces are
+    accumulated in the same order and results don't depend on the broad phase. */
+    void sweep_pairs(OcNodeGroup *group1, OcNodeGroup *group2) {
+        int count = group1->count + ((group1 == group2) ? 0 : group2->count);
+        if (count > bounds_cap) {
+            bounds_cap = count + 256;
+            bounds = (_Bound *)realloc(bounds, sizeof(_Bound) * bounds_cap);
+        }
+
+        int bounds_count = add_bounds(group1, 0, 0);
+        if (group1 != group2)
+            bounds_count = add_bounds(group2, 1, bounds_count);
+        qsort(bounds, bounds_count, sizeof(_Bound), _compare_bounds);
+
+        pairs_count = 0;
+        for (int i = 0; i < bounds_count; ++i) {
+            _Bound *b1 = bounds + i;
+            for (int j = i + 1; j < bounds_count && bounds[j].min <= b1->max; ++j) {
+                _Bound *b2 = bounds + j;
+                if (group1 == group2)
+                    add_pair(b1->index < b2->index ? b1->index : b2->index,
+                             b1->index < b2->index ? b2->index : b1->index);
+                else if (b1->group_i != b2->group_i)
+                    add_pair(b1->group_i == 0 ? b1->index : b2->index,
+                             b1->group_i == 0 ? b2->index : b1->index);
+            }
+        }
+        qsort(pairs, pairs_count, sizeof(OcPair), _compare_pairs);
+    }
+
+    /* Same pairs as sweep_pairs(). If the handler's groups have the same agents as last time and
+    only a few of them moved, pairs of agents that didn't move are kept and only moved agents are
+    tested against all the others. */
+    void find_pairs(OcNodeGroup *group1, OcNodeGroup *group2, _PairCache *cache) {
+        int count1 = group1->count;
+        int count = count1 + ((group1 == group2) ? 0 : group2->count);
+
+        bool same_agents = count > 0 && cache->agents_count == count && cache->count1 == count1 &&
+                           memcmp(cache->agents, group1->agents, sizeof(void *) * count1) == 0 &&
+                           (group1 == group2 || memcmp(cache->agents + count1, group2->agents, sizeof(void *) * (count - count1)) == 0);
+
+        if (count > cache->agents_cap) {
+            cache->agents_cap = count + 256;
+            cache->agents = (void **)realloc(cache->agents, sizeof(void *) * cache->agents_cap);
+            cache->mins = (float *)realloc(cache->mins, sizeof(float) * cache->agents_cap);
+            cache->maxs = (float *)realloc(cache->maxs, sizeof(float) * cache->agents_cap);
+            cache->moved = (bool *)realloc(cache->moved, sizeof(bool) * cache->agents_cap);
+        }
+
+        /* find moved agents and remember current bounds */
+
+        int moved_count = 0;
+        for (int i = 0; i < count; ++i) {
+            OcNodeGroup *group = (i < count1) ? group1 : group2;
+            int index = (i < count1) ? i : i - count1;
+            float min = group->get_bound(index, group->min_offset);
+            float max = group->get_bound(index, group->max_offset);
+            cache->moved[i] = !same_agents || min != cache->mins[i] || max != cache->maxs[i];
+            if (cache->moved[i])
+                ++moved_count;
+            cache->agents[i] = group->agents[index];
+            cache->mins[i] = min;
+            cache->maxs[i] = max;
+        }
+        cache->count1 = count1;
+        cache->agents_count = count;
+
+        if (moved_count * 4 > count) /* too many moved, sweep is quicker */
+            sweep_pairs(group1, group2);
+        else {
+            pairs_count = 0;
+
+            for (int i = 0; i < cache->pairs_count; ++i) { /* keep pairs of agents that didn't move */
+                OcPair *p = cache->pairs + i;
+                int i2 = (group1 == group2) ? p->i2 : count1 + p->i2;
+                if (!cache->moved[p->i1] && !cache->moved[i2])
+                    add_pair(p->i1, p->i2);
+            }
+
+            for (int i = 0; i < count; ++i) { /* test moved agents against all others */
+                if (!cache->moved[i])
+                    continue;
+
+                int beg = 0, end = count; /* agents moved agent can pair with */
+                if (group1 != group2) {
+                    beg = (i < count1) ? count1 : 0;
+                    end = (i < count1) ? count : count1;
+                }
+
+                for (int j = beg; j < end; ++j) {
+                    if (j == i || (cache->moved[j] && j < i)) /* pairs of two moved agents are only added once */
+                        continue;
+                    if (cache->mins[j] > cache->maxs[i] || cache->mins[i] > cache->maxs[j])
+                        continue;
+                    if (group1 == group2)
+                        add_pair(i < j ? i : j, i < j ? j : i);
+                    else
+                        add_pair(i < count1 ? i : j, (i < count1 ? j : i) - count1);
+                }
+            }
+
+            qsort(pairs, pairs_count, sizeof(OcPair), _compare_pairs);
+        }
+
+        if (pairs_count > cache->pairs_cap) {
+            cache->pairs_cap = pairs_count + 256;
+            cache->pairs = (OcPair *)realloc(cache->pairs, sizeof(OcPair) * cache->pairs_cap);
+        }
+        memcpy(cache->pairs, pairs, sizeof(OcPair) * pairs_count);
+        cache->pairs_count = pairs_count;
+    }
+
+    /* Same pairs the full double loop visits, in the same order. */
+    void find_all_pairs(OcNodeGroup *group1, OcNodeGroup *group2) {
+        pairs_count = 0;
+        if (group1 == group2) {
+            for (int j = 0; j < group1->count - 1; ++j)
+                for (int k = j + 1; k < group1->count; ++k)
+                    add_pair(j, k);
+        }
+        else {
+            for (int j = 0; j < group1->count; ++j)
+                for (int k = 0; k < group2->count; ++k)
+                    add_pair(j, k);
+        }
+    }
+
+    struct _ForceJobs {
+        OcState *state;
+        _Handler *handler;
+    };
+
+    static void _force_job(void *data, int job_i, int) {
+        _ForceJobs *jobs = (_ForceJobs *)data;
+        OcState *s = jobs->state;
+        OcNodeGroup *group1 = jobs->handler->node_force_interact.group1;
+        OcNodeGroup *group2 = jobs->handler->node_force_interact.group2;
+        OC_INTERACTION_BATCH func = jobs->handler->node_force_interact.func;
+
+        int beg = job_i * PAIRS_PER_JOB;
+        int end = beg + PAIRS_PER_JOB;
+        if (end > s->pairs_count)
+            end = s->pairs_count;
+        func(group1->agents, group2->agents, s->pairs + beg, s->pair_forces + beg, end - beg, s->exec_context);
+    }
+
+    /* Calculates forces between pairs of agents on all workers, each pair's force is kept
+    separately and forces are added to agents afterwards in pair order. Agents' forces are
+    therefore accumulated in the same order regardless of the number of workers and results
+    are identical to a single worker run. */
+    void run_force_interact(_Handler &h) {
+        OcNodeGroup *group1 = h.node_force_interact.group1;
+        OcNodeGroup *group2 = h.node_force_interact.group2;
+
+        if (group1->has_bounds() && group2->has_bounds()) /* broad phase */
+            find_pairs(group1, group2, pair_caches + (&h - handlers));
+        else
+            find_all_pairs(group1, group2);
+
+        _ForceJobs force_jobs;
+        force_jobs.state = this;
+        force_jobs.handler = &h;
+        int jobs_count = (pairs_count + PAIRS_PER_JOB - 1) / PAIRS_PER_JOB;
+        jobs_run(jobs, _force_job, &force_jobs, jobs_count, (pairs_count < MIN_PARALLEL_PAIRS) ? 1 : workers_count);
+
+        for (int i = 0; i < pairs_count; ++i) {
+            OcForce *pf = pair_forces + i;
+            if (pf->interacted) {
+                group1->add_force(pairs[i].i1, pf->f, -1.0f);
+                group2->add_force(pairs[i].i2, pf->f, 1.0f);
+            }
+        }
+    }
+
+    bool run(int iterations, OcReport *report) {
+        report->iterations = 0;
+        report->residual = 0.0f;
+        report->converged = false;
+
         for (int iteration = 0; iteration < iterations; ++iteration) {
 
             /* reset node forces */
@@ -306,15 +658,39 @@ struct OcState {
                         OcNodeGroup *group = h.node_act.group;
                         VPTR_FUNC func = h.node_act.func;
 
+                        group->scatter_force(); /* handler writes agents' forces */
                         for (int j = 0; j < group->count; ++j)
                             func(group->agents[j], exec_context);
+                        group->gather_force();
+                    }
+                    else if (h.type == NODE_FORCE) {
+                        OcNodeGroup *group = h.node_force_act.group;
+                        OC_ACTION_BATCH func = h.node_force_act.func;
+
+                        if (group->count > forces_cap) {
+                            forces_cap = group->count + 256;
+                            forces = (OcForce *)realloc(forces, sizeof(OcForce) * forces_cap);
+                        }
+                        func(group->agents, forces, group->count, exec_context);
+                        for (int j = 0; j < group->count; ++j)
+                            if (forces[j].interacted)
+                                group->add_force(j, forces[j].f, 1.0f);
                     }
                     else if (h.type == NODE_NODE) {
                         OcNodeGroup *group1 = h.node_interact.group1;
                         OcNodeGroup *group2 = h.node_interact.group2;
                         VPTR_VPTR_FUNC func = h.node_interact.func;
 
-                        if (group1 == group2) {
+                        group1->scatter_force(); /* handler writes agents' forces */
+                        if (group2 != group1)
+                            group2->scatter_force();
+
+                        if (group1->has_bounds() && group2->has_bounds()) { /* broad phase */
+                            find_pairs(group1, group2, pair_caches + i);
+                            for (int j = 0; j < pairs_count; ++j)
+                                func(group1->agents[pairs[j].i1], group2->agents[pairs[j].i2], exec_context);
+                        }
+                        else if (group1 == group2) {
                             for (int j = 0; j < group1->count - 1; ++j)
                                 for (int k = j + 1; k < group1->count; ++k)
                                     func(group1->agents[j], group1->agents[k], exec_context);
@@ -324,7 +700,13 @@ struct OcState {
                                 for (int k = 0; k < group2->count; ++k)
                                     func(group1->agents[j], group2->agents[k], exec_context);
                         }
+
+                        group1->gather_force();
+                        if (group2 != group1)
+                            group2->gather_force();
                     }
+                    else if (h.type == NODE_NODE_FORCE)
+                        run_force_interact(h);
                     else if (h.type == LINK) {
                         OcLinkGroup *group = h.link_act.group;
                         VPTR_FUNC func = h.link_act.func;
@@ -353,9 +735,11 @@ struct OcState {
                         OcNodeGroup *node_group = h.link_node_interact.node_group;
                         VPTR_VPTR_FUNC func = h.link_node_interact.func;
 
+                        node_group->scatter_force(); /* handler may write agents' forces */
                         for (int j = 0; j < link_group->count; ++j)
                             for (int k = 0; k < node_group->count; ++k)
                                 func(link_group->agents[j], node_group->agents[k], exec_context);
+                        node_group->gather_force();
                     }
                     else
                         assert(false); /* unhandled handler type */
@@ -370,78 +754,131 @@ struct OcState {
             for (int i = 0; i < node_groups_count; ++i)
                 max_f = node_groups[i].get_max_force(max_f);
 
-            if (max_f < 0.01)
+            report->residual = max_f;
+            if (max_f < tolerance) {
+                report->converged = true;
+                sync_forces();
                 return false;
+            }
 
-            // TODO: extract coefficients of this expression into API and document it
-            float f_normalizer = (max_f > 0.5f) ? (0.5f / max_f) : max_f; /* tweak to tune relaxation speed */
-
-            for (int i = 0; i < node_groups_count; ++i)
-                node_groups[i].normalize_force(f_normalizer);
+            /* large forces are scaled down to max step, small ones are scaled by their own
+            size so agents slow down as they approach equilibrium */
+            float f_normalizer = (max_f > max_step) ? (max_step / max_f) : max_f;
 
             /* finalize objects */
 
             for (int i = 0; i < node_groups_count; ++i)
-                node_groups[i].apply_force();
+                node_groups[i].apply_force(f_normalizer * node_groups[i].damping);
+
+            ++report->iterations;
         }
 
+        sync_forces();
         return true;
     }
-} states[MAX_STATES];
-unsigned states_count = 0;
 
+    /* Leaves last forces in agents when run is done. */
+    void sync_forces() {
+        for (int i = 0; i < node_groups_count; ++i)
+            node_groups[i].scatter_force();
+    }
+};
+
+/* States don't share anything, so different states can be run at the same time. */
 OcState *ochre_add_state() {
-    assert(states_count < MAX_STATES - 1);
-    return states + states_count++;
+    return new OcState();
+}
+
+void ochre_remove_state(OcState *state) {
+    delete state;
+}
+
+/* Sets the pool and number of workers force interactions are calculated on, results don't depend on it. */
+void ochre_set_workers(OcState *state, Jobs *jobs, int workers_count) {
+    assert(state);
+    assert(workers_count >= 1 && workers_count <= JOBS_MAX_WORKERS);
+    assert(jobs || workers_count == 1);
+    state->jobs = jobs;
+    state->workers_count = workers_count;
+}
+
+/* Sets force below which the run is considered converged and the largest step an agent can
+make in one iteration. */
+void ochre_set_convergence(OcState *state, double tolerance, float max_step) {
+    assert(state);
+    state->tolerance = tolerance;
+    state->max_step = max_step;
 }
 
 void ochre_set_exec_context(OcState *state, void *exec_context) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     state->exec_context = exec_context;
 }
 
 OcNodeGroup *ochre_add_node_group(OcState *state, unsigned f_offset, unsigned p_offset, OcLayout layout) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     return state->add_node_group(f_offset, p_offset, layout);
 }
 
+/* Registers offsets of agents' float bounds along an axis. Node interactions between groups
+with bounds are only called for agents whose bounds overlap, bounds are read when the
+interaction is run, so they can be updated by actions in earlier phases. */
+void ochre_set_node_group_bounds(OcNodeGroup *node_group, unsigned min_offset, unsigned max_offset) {
+    node_group->min_offset = min_offset;
+    node_group->max_offset = max_offset;
+}
+
+void ochre_set_node_group_damping(OcNodeGroup *node_group, float damping) {
+    node_group->damping = damping;
+}
+
 OcNodeGroup *ochre_add_inert_node_group(OcState *state) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     return state->add_inert_node_group();
 }
 
 OcLinkGroup *ochre_add_link_group(OcState *state) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     return state->add_link_group();
 }
 
 void ochre_add_node_action(OcState *state, OcNodeGroup *node_group, VPTR_FUNC func, unsigned phase) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     state->add_node_act(node_group, func, phase);
 }
 
+void ochre_add_node_force_action(OcState *state, OcNodeGroup *node_group, OC_ACTION_BATCH func, unsigned phase) {
+    assert(state);
+    state->add_node_force_act(node_group, func, phase);
+}
+
 void ochre_add_link_action(OcState *state, OcLinkGroup *link_group, VPTR_FUNC func, unsigned phase) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     state->add_link_act(link_group, func, phase);
 }
 
 void ochre_add_node_interaction(OcState *state, OcNodeGroup *node_group1, OcNodeGroup *node_group2, VPTR_VPTR_FUNC func, unsigned phase) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     state->add_node_interact(node_group1, node_group2, func, phase);
 }
 
+void ochre_add_node_force_interaction(OcState *state, OcNodeGroup *node_group1, OcNodeGroup *node_group2, OC_INTERACTION_BATCH func, unsigned phase) {
+    assert(state);
+    state->add_node_force_interact(node_group1, node_group2, func, phase);
+}
+
 void ochre_add_link_interaction(OcState *state, OcLinkGroup *link_group1, OcLinkGroup *link_group2, VPTR_VPTR_FUNC func, unsigned phase) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     state->add_link_interact(link_group1, link_group2, func, phase);
 }
 
 void ochre_add_link_node_interaction(OcState *state, OcLinkGroup *link_group, OcNodeGroup *node_group, VPTR_VPTR_FUNC func, unsigned phase) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     state->add_link_node_interact(link_group, node_group, func, phase);
 }
 
 void ochre_clear_data(OcState *state) {
-    assert(state >= states && state < states + states_count);
+    assert(state);
     state->clear_data();
 }
 
@@ -453,7 +890,13 @@ void ochre_add_link(OcLinkGroup *link_group, void *link) {
     link_group->add(link);
 }
 
-bool ochre_run(OcState *state, unsigned iterations) {
-    assert(state >= states && state < states + states_count);
-    return state->run(iterations);
+/* Runs at most given number of iterations, returns false if forces converged before that.
+Report is optional. */
+bool ochre_run(OcState *state, unsigned iterations, OcReport *report) {
+    assert(state);
+    OcReport r;
+    bool moving = state->run(iterations, &r);
+    if (report)
+        *report = r;
+    return moving;
 }
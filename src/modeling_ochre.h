@@ -2,6 +2,7 @@
 #define ochre_api
 
 
+struct Jobs;
 struct OcState;
 struct OcNodeGroup;
 struct OcLinkGroup;
@@ -13,17 +14,67 @@ enum OcLayout {
 
 typedef void (*VPTR_FUNC)(void *e, void *exec_context);
 typedef void (*VPTR_VPTR_FUNC)(void *e1, void *e2, void *exec_context);
+/* Calculates force f acting on an agent without touching it, returns false if there's none.
+Force is added to agent's force kept by ochre, which is cheaper than writing it directly. */
+typedef bool (*VPTR_FORCE_FUNC)(void *e, float *f, void *exec_context);
+/* Calculates force f between two agents without touching them, returns false if they don't
+interact. Force is added to e2 and subtracted from e1 by ochre, which allows such interactions
+to run on several workers. */
+typedef bool (*VPTR_VPTR_FORCE_FUNC)(void *e1, void *e2, float *f, void *exec_context);
+
+/* What happened during ochre_run(). */
+struct OcReport {
+    unsigned iterations;    /* in which agents moved */
+    float residual;         /* largest force in the last iteration */
+    bool converged;
+};
+
+/* Indices of two interacting agents in their groups. */
+struct OcPair {
+    int i1, i2;
+};
+
+struct OcForce {
+    float f[3];
+    bool interacted;
+};
+
+/* Force callbacks are called in batches, through one indirect call per batch instead of one
+per agent or pair. Batches are made from force callbacks known at compile time with
+ochre_action_batch<func> and ochre_interaction_batch<func>, which lets the compiler inline
+callbacks into the loops. */
+typedef void (*OC_ACTION_BATCH)(void **agents, OcForce *forces, int count, void *exec_context);
+typedef void (*OC_INTERACTION_BATCH)(void **agents1, void **agents2, OcPair *pairs, OcForce *forces, int count, void *exec_context);
+
+template<VPTR_FORCE_FUNC func>
+void ochre_action_batch(void **agents, OcForce *forces, int count, void *exec_context) {
+    for (int i = 0; i < count; ++i)
+        forces[i].interacted = func(agents[i], forces[i].f, exec_context);
+}
+
+template<VPTR_VPTR_FORCE_FUNC func>
+void ochre_interaction_batch(void **agents1, void **agents2, OcPair *pairs, OcForce *forces, int count, void *exec_context) {
+    for (int i = 0; i < count; ++i)
+        forces[i].interacted = func(agents1[pairs[i].i1], agents2[pairs[i].i2], forces[i].f, exec_context);
+}
 
 OcState *ochre_add_state();
+void ochre_remove_state(OcState *state);
 
 void ochre_set_exec_context(OcState *state, void *exec_context);
+void ochre_set_workers(OcState *state, Jobs *jobs, int workers_count);
+void ochre_set_convergence(OcState *state, double tolerance, float max_step);
 OcNodeGroup *ochre_add_node_group(OcState *state, unsigned f_offset, unsigned p_offset, OcLayout layout);
+void ochre_set_node_group_bounds(OcNodeGroup *node_group, unsigned min_offset, unsigned max_offset);
+void ochre_set_node_group_damping(OcNodeGroup *node_group, float damping);
 OcNodeGroup *ochre_add_inert_node_group(OcState *state);
 OcLinkGroup *ochre_add_link_group(OcState *state);
 
 void ochre_add_node_action(OcState *state, OcNodeGroup *node_group, VPTR_FUNC func, unsigned phase);
+void ochre_add_node_force_action(OcState *state, OcNodeGroup *node_group, OC_ACTION_BATCH func, unsigned phase);
 void ochre_add_link_action(OcState *state, OcLinkGroup *link_group, VPTR_FUNC func, unsigned phase);
 void ochre_add_node_interaction(OcState *state, OcNodeGroup *node_group1, OcNodeGroup *node_group2, VPTR_VPTR_FUNC func, unsigned phase);
+void ochre_add_node_force_interaction(OcState *state, OcNodeGroup *node_group1, OcNodeGroup *node_group2, OC_INTERACTION_BATCH func, unsigned phase);
 void ochre_add_link_interaction(OcState *state, OcLinkGroup *link_group1, OcLinkGroup *link_group2, VPTR_VPTR_FUNC func, unsigned phase);
 void ochre_add_link_node_interaction(OcState *state, OcLinkGroup *link_group, OcNodeGroup *node_group, VPTR_VPTR_FUNC func, unsigned phase);
 
@@ -31,7 +82,7 @@ void ochre_clear_data(OcState *state);
 void ochre_add_node(OcNodeGroup *node_group, void *node);
 void ochre_add_link(OcLinkGroup *link_group, void *link);
 
-bool ochre_run(OcState *state, unsigned iterations);
+bool ochre_run(OcState *state, unsigned iterations, OcReport *report=0);
 
 bool ochre_interact_prism_and_prism(int count1, struct vec2 *nodes1, float min1, float max1,
                                     int count2, struct vec2 *nodes2, float min2, float max2,
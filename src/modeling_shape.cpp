@@ -3,6 +3,45 @@
 #include "math_dvec.h"
 #include <assert.h>
 
+/* Curves are sampled two coordinates at a time with SSE2, which x64 always has. Defining
+SHAPE_NO_SIMD forces the scalar version. */
+#if defined(SHAPE_NO_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define _SHAPE_SSE2
+#endif
+
+/* Bernstein weights of a curve sample, the middle one still has to be multiplied by curve weight. */
+struct _Bernstein {
+    double a, b, c;
+};
+
+/* Weights for every number of samples per curve, packed so that samples for count n start at n * (n - 1) / 2. */
+#define _BERNSTEIN_OFFSET(__n__) ((__n__) * ((__n__) - 1) / 2)
+#define _BERNSTEIN_COUNT _BERNSTEIN_OFFSET(SHAPE_MAX_CURVE_SAMPLES + 1)
+
+struct _BernsteinTable {
+    _Bernstein weights[_BERNSTEIN_COUNT];
+};
+
+static _BernsteinTable _make_bernstein_table() {
+    _BernsteinTable table;
+    for (int n = 1; n <= SHAPE_MAX_CURVE_SAMPLES; ++n) {
+        _Bernstein *weights = table.weights + _BERNSTEIN_OFFSET(n);
+        double dt = 1.0 / n;
+        for (int k = 0; k < n; ++k) {
+            double t = k * dt;
+            double _t = 1.0 - t;
+            weights[k].a = _t * _t;
+            weights[k].b = 2.0 * t * _t;
+            weights[k].c = t * t;
+        }
+    }
+    return table;
+}
+
+static const _BernsteinTable _bernstein_table = _make_bernstein_table();
+
 
 Shape shape_make(double x, double y, double d1, double d2, double d3, double d4, double w1, double w2, double w3, double w4) {
     Shape s;
@@ -126,34 +165,49 @@ void shape_translate(Shape *shape, double dx, double dy) {
     }
 }
 
-dvec shape_bezier(double ax, double ay, double bx, double by, double cx, double cy, double t, double w) {
-    double _t = 1.0 - t;
-    double _a = _t * _t;
-    double _b = 2.0f * t * _t * w;
-    double _c = t * t;
-    dvec v;
-    v.x = (ax * _a + bx * _b + cx * _c) / (_a + _b + _c);
-    v.y = (ay * _a + by * _b + cy * _c) / (_a + _b + _c);
-    return v;
+void shape_sample_bundle(Shape **shapes, int shapes_count, int curve_samples, dvec *verts) {
+    assert(curve_samples > 0 && curve_samples <= SHAPE_MAX_CURVE_SAMPLES);
+    const _Bernstein *weights = _bernstein_table.weights + _BERNSTEIN_OFFSET(curve_samples);
+
+    for (int shape_i = 0; shape_i < shapes_count; ++shape_i) {
+        Curve *curves = shapes[shape_i]->curves;
+        dvec *v = verts + shape_i;
+
+        for (int i = 0; i < SHAPE_CURVES; ++i) {
+            Curve *curve1 = curves + i;
+            Curve *curve2 = curves + ((i + 1) % SHAPE_CURVES);
+            double w = curve1->w;
+
+#ifdef _SHAPE_SSE2
+            __m128d p1 = _mm_set_pd(curve1->y, curve1->x);
+            __m128d p2 = _mm_set_pd(curve1->cy, curve1->cx);
+            __m128d p3 = _mm_set_pd(curve2->y, curve2->x);
+
+            for (int k = 0; k < curve_samples; ++k, v += shapes_count) {
+                __m128d a = _mm_set1_pd(weights[k].a);
+                __m128d b = _mm_set1_pd(weights[k].b * w);
+                __m128d c = _mm_set1_pd(weights[k].c);
+                __m128d num = _mm_add_pd(_mm_add_pd(_mm_mul_pd(p1, a), _mm_mul_pd(p2, b)), _mm_mul_pd(p3, c));
+                __m128d den = _mm_add_pd(_mm_add_pd(a, b), c);
+                _mm_storeu_pd(&v->x, _mm_div_pd(num, den));
+            }
+#else
+            for (int k = 0; k < curve_samples; ++k, v += shapes_count) {
+                double a = weights[k].a;
+                double b = weights[k].b * w;
+                double c = weights[k].c;
+                double den = a + b + c;
+                v->x = (curve1->x * a + curve1->cx * b + curve2->x * c) / den;
+                v->y = (curve1->y * a + curve1->cy * b + curve2->y * c) / den;
+            }
+#endif
+        }
+    }
 }
 
 void shape_get_vertices(Shape *s, int count, dvec *verts) {
     assert(count % SHAPE_CURVES == 0);
-    int curve_subdivs = count / SHAPE_CURVES;
-    double dt = 1.0 / curve_subdivs;
-    dvec *v = verts;
-    for (int i = 0; i < SHAPE_CURVES; ++i) {
-        int next_i = (i + 1) % SHAPE_CURVES;
-        for (int j = 0; j < curve_subdivs; ++j) {
-            double t = j * dt;
-            *v++ = shape_bezier(
-                s->curves[i].x, s->curves[i].y,
-                s->curves[i].cx, s->curves[i].cy,
-                s->curves[next_i].x, s->curves[next_i].y,
-                t, s->curves[i].w
-            );
-        }
-    }
+    shape_sample_bundle(&s, 1, count / SHAPE_CURVES, verts);
 }
 
 dvec shape_centroid(Shape *shape) {
@@ -8,6 +8,7 @@
 #define SHAPE_W_MIN                     0.1
 #define SHAPE_W_MAX                     4.0
 #define SHAPE_W_CIRCLE                  0.70710678
+#define SHAPE_MAX_CURVE_SAMPLES         32
 
 
 struct dvec;
@@ -45,7 +46,8 @@ void shape_update_curve_control_points(Curve *curves);
 
 void shape_translate(Shape *shape, double dx, double dy);
 void shape_get_vertices(Shape *shape, int count, dvec *verts);
-dvec shape_bezier(double ax, double ay, double bx, double by, double cx, double cy, double t, double w);
+/* Samples curves of all shapes at once, putting vertices of all shapes for a sample next to each other. */
+void shape_sample_bundle(Shape **shapes, int shapes_count, int curve_samples, dvec *verts);
 dvec shape_centroid(Shape *shape);
 
 #endif
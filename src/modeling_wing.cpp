@@ -38,3 +38,15 @@ void wing_reset_target_position(Wing *w) {
     w->ty = w->y;
     w->tz = w->z;
 }
+
+/* Returns true if wing changed in a way that affects fuselage skin since it was last lofted. */
+bool wing_loft_dirty(Wing *w) {
+    return w->loft_dirty || w->x != w->loft_x || w->y != w->loft_y || w->z != w->loft_z;
+}
+
+void wing_loft_clean(Wing *w) {
+    w->loft_dirty = false;
+    w->loft_x = w->x;
+    w->loft_y = w->y;
+    w->loft_z = w->z;
+}
@@ -28,6 +28,14 @@ struct Wing {
     float tx, ty, tz; /* target position, used for dragging */
     float fx, fy, fz; /* forces acting on wing during collision */
     bool selected;
+
+    /* loft */
+    bool loft_dirty;                /* definition changed since last lofted */
+    float loft_x, loft_y, loft_z;   /* position when last lofted */
+
+    /* collision */
+    bool coll_dirty;                /* added to model since collision came to rest */
+    float coll_x, coll_y, coll_z;   /* position when collision came to rest */
 };
 
 float wing_get_nominal_root_chord(Wing *w);
@@ -36,5 +44,7 @@ int wing_get_required_stations(Wing *w, float *stations);
 // bool wing_should_be_mirrored(Wing *w);
 void wing_move_target_position(Wing *w, float dx, float dy, float dz);
 void wing_reset_target_position(Wing *w);
+bool wing_loft_dirty(Wing *w);
+void wing_loft_clean(Wing *w);
 
 #endif
@@ -6,6 +6,8 @@
 #include <windows.h>
 #else
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #endif
 
 
@@ -27,3 +29,34 @@ void *platform_fopen(const char *path, const char *mode) {
     assert(f != 0);
     return f;
 }
+
+/* Calls func with full path of each regular file in dir. Returns false if dir cannot be opened. */
+bool platform_list_dir(const char *dir, PLATFORM_PATH_FUNC func, void *data) {
+    char path[1024];
+#ifdef PLATFORM_WIN
+    WIN32_FIND_DATAA find_data;
+    snprintf(path, sizeof(path), "%s\\*", dir);
+    HANDLE h = FindFirstFileA(path, &find_data);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    do {
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        snprintf(path, sizeof(path), "%s\\%s", dir, find_data.cFileName);
+        func(path, data);
+    } while (FindNextFileA(h, &find_data));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    if (d == 0)
+        return false;
+    for (dirent *e = readdir(d); e != 0; e = readdir(d)) {
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            func(path, data);
+    }
+    closedir(d);
+#endif
+    return true;
+}
@@ -4,7 +4,10 @@
 #define PLATFORM_WIN
 
 
+typedef void (*PLATFORM_PATH_FUNC)(const char *path, void *data);
+
 void platform_sleep(int milliseconds);
 void *platform_fopen(const char *path, const char *mode);
+bool platform_list_dir(const char *dir, PLATFORM_PATH_FUNC func, void *data);
 
 #endif
@@ -9,7 +9,7 @@
 #include <iostream>
 
 
-static Arena apame_arena(100000000);
+static Arena apame_arena(10000000, ARENA_CHUNKED, "apame");
 
 void boids_apame_run(Model *model) {
 
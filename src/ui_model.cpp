@@ -189,20 +189,18 @@ void ui_model_draw_corrs(UiModel *ui_model, ShaderProgram &program) {
 }
 #endif
 
-static Arena trias_arena(10000000);
-static Arena quads_arena(10000000);
-static Arena values_arena(10000000);
+static Arena trias_arena(1000000, ARENA_CONTIGUOUS, "ui trias");
+static Arena quads_arena(1000000, ARENA_CONTIGUOUS, "ui quads");
+static Arena values_arena(1000000, ARENA_CHUNKED, "ui values");
 
 /* make triangles and quads for drawing from generated panels */
 void ui_model_update_skin(UiModel *ui_model, SkinVertColorSource source) {
     Model *m = &ui_model->model;
 
     trias_arena.clear();
-    ui_model->skin_trias = trias_arena.rest<int>();
     ui_model->skin_trias_count = 0;
 
     quads_arena.clear();
-    ui_model->skin_quads = quads_arena.rest<int>();
     ui_model->skin_quads_count = 0;
 
     for (int i = 0; i < m->panels_count; ++i) {
@@ -224,6 +222,9 @@ void ui_model_update_skin(UiModel *ui_model, SkinVertColorSource source) {
         }
     }
 
+    ui_model->skin_trias = trias_arena.base<int>(); /* arenas may have moved while growing */
+    ui_model->skin_quads = quads_arena.base<int>();
+
     /* update values */
 
     values_arena.clear();
@@ -4,8 +4,7 @@
 #include "modeling_model.h"
 #include "ui_mantle.h"
 
-#define MAX_MODEL_MANTLES   100
-#define DRAW_CORRS          0 /* just for debugging */
+#define MAX_MODEL_MANTLES   MAX_ELEMS /* model elements of either kind */
 
 
 struct mat4_stack;
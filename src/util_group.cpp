@@ -1,66 +1,182 @@
 #include "util_group.h"
+#include "memory_arena.h"
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 
+#define _MAX_GRID_DIM 64
 
-void group_objects(int size, void *objs, int count, GROUP_FUNC func, GroupMaker *maker) {
-    assert(count <= GROUP_MAX_OBJS);
 
-    maker->count = 0;
+/* Returns root of object's set, halving the path on the way. */
+static int _find(int *parents, int i) {
+    while (parents[i] != i) {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+    }
+    return i;
+}
 
-    /* propagate group ids */
+/* Tests two objects if they're not already in the same set, and joins their sets if they
+should be grouped. Lower index becomes the root so groups come out in order of their first object. */
+static void _try_union(int size, void *objs, GROUP_FUNC func, int *parents, int a_i, int b_i) {
+    int a_root = _find(parents, a_i);
+    int b_root = _find(parents, b_i);
+    if (a_root == b_root)
+        return;
+    if (!func((char *)objs + a_i * size, (char *)objs + b_i * size))
+        return;
+    if (a_root < b_root)
+        parents[b_root] = a_root;
+    else
+        parents[a_root] = b_root;
+}
 
-    int group_ids[GROUP_MAX_OBJS]; /* maps object index to group id */
-    for (int i = 0; i < GROUP_MAX_OBJS; ++i)
-        group_ids[i] = -1;
+static int _cell_coord(double v, double lo, double cell_size, int dim) {
+    int c = (int)((v - lo) / cell_size);
+    if (c < 0)
+        return 0;
+    if (c >= dim)
+        return dim - 1;
+    return c;
+}
 
-    int next_available_group_id = 0;
+/* Only tests objects whose bounds overlap. Bounds are bucketed into a grid, and a pair is only
+tested in the first cell both objects are in, so it's tested at most once. */
+static void _union_with_grid(Arena *arena, int size, void *objs, int count, GROUP_FUNC func,
+                             GROUP_BOUNDS_FUNC bounds_func, int *parents) {
+    double *mins = arena->alloc<double>(count * 2);
+    double *maxs = arena->alloc<double>(count * 2);
+    double lo[2] = { HUGE_VAL, HUGE_VAL };
+    double hi[2] = { -HUGE_VAL, -HUGE_VAL };
+    for (int i = 0; i < count; ++i) {
+        bounds_func((char *)objs + i * size, mins + i * 2, maxs + i * 2);
+        for (int k = 0; k < 2; ++k) {
+            if (mins[i * 2 + k] < lo[k])
+                lo[k] = mins[i * 2 + k];
+            if (maxs[i * 2 + k] > hi[k])
+                hi[k] = maxs[i * 2 + k];
+        }
+    }
 
-    for (int a_i = 0; a_i < count; ++a_i) {
-        void *a_o = (char *)objs + a_i * size;
+    int dim = (int)sqrt((double)count) + 1;
+    if (dim > _MAX_GRID_DIM)
+        dim = _MAX_GRID_DIM;
+    double cell_size[2];
+    for (int k = 0; k < 2; ++k) {
+        cell_size[k] = (hi[k] - lo[k]) / dim;
+        if (!(cell_size[k] > 0.0))
+            cell_size[k] = 1.0;
+    }
 
-        if (group_ids[a_i] == -1)
-            group_ids[a_i] = next_available_group_id++;
+    /* object cell ranges */
 
-        for (int b_i = a_i + 1; b_i < count; ++b_i) {
-            void *b_o = (char *)objs + b_i * size;
+    int *cells = arena->alloc<int>(count * 4); /* min x, min y, max x, max y */
+    int *cell_counts = arena->alloc<int>(dim * dim + 1, true);
+    for (int i = 0; i < count; ++i) {
+        int *c = cells + i * 4;
+        for (int k = 0; k < 2; ++k) {
+            c[k] = _cell_coord(mins[i * 2 + k], lo[k], cell_size[k], dim);
+            c[k + 2] = _cell_coord(maxs[i * 2 + k], lo[k], cell_size[k], dim);
+        }
+        for (int y = c[1]; y <= c[3]; ++y)
+            for (int x = c[0]; x <= c[2]; ++x)
+                ++cell_counts[y * dim + x + 1];
+    }
 
-            if (!func(a_o, b_o))
-                continue;
+    /* bucket objects, in order of their indices within each cell */
 
-            if (group_ids[b_i] == -1)
-                group_ids[b_i] = group_ids[a_i];
-            else if (group_ids[b_i] != group_ids[a_i]) {
-                int b_group_id = group_ids[b_i];
-                for (int c_i = 0; c_i < count; ++c_i)
-                    if (group_ids[c_i] == b_group_id)
-                        group_ids[c_i] = group_ids[a_i];
+    for (int i = 0; i < dim * dim; ++i) /* cell offsets */
+        cell_counts[i + 1] += cell_counts[i];
+    int *buckets = arena->alloc<int>(cell_counts[dim * dim]);
+    for (int i = 0; i < count; ++i) {
+        int *c = cells + i * 4;
+        for (int y = c[1]; y <= c[3]; ++y)
+            for (int x = c[0]; x <= c[2]; ++x)
+                buckets[cell_counts[y * dim + x]++] = i;
+    }
+    /* cell_counts[i] is now end of cell i and beginning of cell i + 1 */
+
+    for (int y = 0; y < dim; ++y) {
+        for (int x = 0; x < dim; ++x) {
+            int cell_i = y * dim + x;
+            int beg = (cell_i == 0) ? 0 : cell_counts[cell_i - 1];
+            int end = cell_counts[cell_i];
+
+            for (int j = beg; j < end; ++j) {
+                int a_i = buckets[j];
+                int *a_c = cells + a_i * 4;
+                double *a_min = mins + a_i * 2;
+                double *a_max = maxs + a_i * 2;
+
+                for (int l = j + 1; l < end; ++l) {
+                    int b_i = buckets[l];
+                    int *b_c = cells + b_i * 4;
+
+                    /* only test in the first shared cell */
+                    if ((a_c[0] > b_c[0] ? a_c[0] : b_c[0]) != x ||
+                        (a_c[1] > b_c[1] ? a_c[1] : b_c[1]) != y)
+                        continue;
+
+                    double *b_min = mins + b_i * 2;
+                    double *b_max = maxs + b_i * 2;
+                    if (a_min[0] > b_max[0] || a_max[0] < b_min[0] ||
+                        a_min[1] > b_max[1] || a_max[1] < b_min[1])
+                        continue;
+
+                    _try_union(size, objs, func, parents, a_i, b_i);
+                }
             }
         }
     }
+}
+
+/* Objects are grouped if they're connected through pairs the grouping function accepts. If bounds
+function is given, only objects whose bounds overlap are tested. Groups are ordered by their
+first object, and object indices in a group are in increasing order. */
+void group_objects(Arena *arena, int size, void *objs, int count, GROUP_FUNC func, GROUP_BOUNDS_FUNC bounds_func,
+                   GroupMaker *maker) {
+    maker->count = 0;
+    maker->groups = 0;
+    if (count == 0)
+        return;
+
+    /* join sets of objects that should be grouped */
+
+    int *parents = arena->alloc<int>(count);
+    for (int i = 0; i < count; ++i)
+        parents[i] = i;
+
+    if (bounds_func)
+        _union_with_grid(arena, size, objs, count, func, bounds_func, parents);
+    else {
+        for (int a_i = 0; a_i < count; ++a_i)
+            for (int b_i = a_i + 1; b_i < count; ++b_i)
+                _try_union(size, objs, func, parents, a_i, b_i);
+    }
 
-    /* create blank groups from group ids */
+    /* create blank groups from set roots */
 
-    Group *group_map[GROUP_MAX_OBJS]; /* maps group id to group */
-    memset(group_map, 0, sizeof(Group *) * GROUP_MAX_OBJS);
+    int *group_ids = arena->alloc<int>(count); /* maps root object index to group index */
+    maker->groups = arena->alloc<Group>(count);
 
     for (int i = 0; i < count; ++i) {
-        Group *g = group_map[group_ids[i]];
-        if (g == 0) {
-            g = maker->groups + maker->count++;
-            group_map[group_ids[i]] = g;
+        int root = _find(parents, i);
+        if (root == i) { /* roots are the lowest indices in their sets, so they're first */
+            group_ids[i] = maker->count;
+            Group *g = maker->groups + maker->count++;
             g->count = 0;
             g->obj_indices = 0;
         }
-        ++g->count;
+        ++maker->groups[group_ids[root]].count;
     }
 
     /* set up object indices storage, now we have object counts */
 
+    int *storage = arena->alloc<int>(count);
     int offset = 0;
     for (int i = 0; i < maker->count; ++i) {
         Group *g = maker->groups + i;
-        g->obj_indices = maker->storage + offset;
+        g->obj_indices = storage + offset;
         offset += g->count;
         g->count = 0; /* reset so object indices can be set */
     }
@@ -68,7 +184,7 @@ void group_objects(int size, void *objs, int count, GROUP_FUNC func, GroupMaker
     /* set object indices */
 
     for (int i = 0; i < count; ++i) {
-        Group *g = group_map[group_ids[i]];
+        Group *g = maker->groups + group_ids[_find(parents, i)];
         g->obj_indices[g->count++] = i;
     }
 }
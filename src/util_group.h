@@ -1,24 +1,25 @@
 #ifndef group_h
 #define group_h
 
-#define GROUP_MAX_OBJS (1 << (sizeof(unsigned char) * 8))
 
+struct Arena;
 
 typedef bool (*GROUP_FUNC)(void *, void *);
+typedef void (*GROUP_BOUNDS_FUNC)(void *, double *min, double *max); /* 2D bounds */
 
 struct Group {
     int count; /* number of objects in this group */
-    unsigned char *obj_indices; /* points into storage */
+    int *obj_indices; /* allocated in arena */
 };
 
 struct GroupMaker {
-    Group groups[GROUP_MAX_OBJS];
+    Group *groups; /* allocated in arena */
     int count;
-    unsigned char storage[GROUP_MAX_OBJS];
 };
 
 /* Given an array of objects and grouping function, returns information on how many groups there are
 and how many objects are in each groups and which ones they are. */
-void group_objects(int size, void *objs, int count, GROUP_FUNC func, GroupMaker *maker);
+void group_objects(Arena *arena, int size, void *objs, int count, GROUP_FUNC func, GROUP_BOUNDS_FUNC bounds_func,
+                   GroupMaker *maker);
 
 #endif
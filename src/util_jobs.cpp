@@ -0,0 +1,118 @@
+#include "util_jobs.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <assert.h>
+
+
+struct Jobs {
+    std::thread threads[JOBS_MAX_WORKERS]; /* thread i is worker i, worker 0 is the calling thread */
+    int threads_count;
+    std::mutex mutex;
+    std::condition_variable run_cond;   /* signalled when a run begins or the pool stops */
+    std::condition_variable done_cond;  /* signalled when the last thread finishes its jobs */
+    int run_i;          /* incremented for each run, so threads know they have something to do */
+    int busy_count;     /* threads still running jobs of the current run */
+    bool stopping;
+
+    /* current run */
+    JOB_FUNC func;
+    void *data;
+    int jobs_count;
+    int workers_count;
+    std::atomic<int> next_job;
+};
+
+static void _run_jobs(Jobs *jobs, int worker_i) {
+    for (int job_i = jobs->next_job++; job_i < jobs->jobs_count; job_i = jobs->next_job++)
+        jobs->func(jobs->data, job_i, worker_i);
+}
+
+static void _run_thread(Jobs *jobs, int worker_i) {
+    int run_i = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(jobs->mutex);
+            while (!jobs->stopping && jobs->run_i == run_i)
+                jobs->run_cond.wait(lock);
+            if (jobs->stopping)
+                return;
+            run_i = jobs->run_i;
+            if (worker_i >= jobs->workers_count) /* not needed in this run */
+                continue;
+        }
+
+        _run_jobs(jobs, worker_i);
+
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        if (--jobs->busy_count == 0)
+            jobs->done_cond.notify_one();
+    }
+}
+
+int jobs_hardware_workers() {
+    int count = (int)std::thread::hardware_concurrency();
+    if (count < 1)
+        count = 1;
+    if (count > JOBS_MAX_WORKERS)
+        count = JOBS_MAX_WORKERS;
+    return count;
+}
+
+Jobs *jobs_start() {
+    Jobs *jobs = new Jobs();
+    jobs->threads_count = 1;
+    jobs->run_i = 0;
+    jobs->busy_count = 0;
+    jobs->stopping = false;
+    jobs->workers_count = 0;
+    return jobs;
+}
+
+void jobs_stop(Jobs *jobs) {
+    if (jobs == 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->stopping = true;
+    }
+    jobs->run_cond.notify_all();
+    for (int i = 1; i < jobs->threads_count; ++i)
+        jobs->threads[i].join();
+    delete jobs;
+}
+
+void jobs_run(Jobs *jobs, JOB_FUNC func, void *data, int jobs_count, int workers_count) {
+    assert(workers_count <= JOBS_MAX_WORKERS);
+
+    if (workers_count > jobs_count)
+        workers_count = jobs_count;
+
+    if (workers_count <= 1) { /* no need for threads */
+        for (int i = 0; i < jobs_count; ++i)
+            func(data, i, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        for (; jobs->threads_count < workers_count; ++jobs->threads_count) /* start threads this run is the first to need */
+            jobs->threads[jobs->threads_count] = std::thread(_run_thread, jobs, jobs->threads_count);
+        jobs->func = func;
+        jobs->data = data;
+        jobs->jobs_count = jobs_count;
+        jobs->workers_count = workers_count;
+        jobs->next_job = 0;
+        jobs->busy_count = workers_count - 1;
+        ++jobs->run_i;
+    }
+    jobs->run_cond.notify_all();
+
+    _run_jobs(jobs, 0);
+
+    std::unique_lock<std::mutex> lock(jobs->mutex);
+    while (jobs->busy_count > 0)
+        jobs->done_cond.wait(lock);
+}
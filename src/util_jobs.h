@@ -0,0 +1,25 @@
+#ifndef jobs_h
+#define jobs_h
+
+#define JOBS_MAX_WORKERS 64
+
+
+/* Job callback, job_i is in [0, jobs_count) and worker_i in [0, workers_count). Jobs with the
+same worker_i never run at the same time, so worker_i can be used to index per-worker memory. */
+typedef void (*JOB_FUNC)(void *data, int job_i, int worker_i);
+
+/* Pool of worker threads, kept waiting between runs so running jobs doesn't start threads. */
+struct Jobs;
+
+/* Returns number of workers that can run at the same time on this machine. */
+int jobs_hardware_workers();
+
+/* Threads are only started when a run first needs them, stopping joins all of them. */
+Jobs *jobs_start();
+void jobs_stop(Jobs *jobs);
+
+/* Runs all jobs, distributing them between workers, and returns when all jobs are done. Worker
+0 is the calling thread. A pool runs one set of jobs at a time, jobs can run jobs on another pool. */
+void jobs_run(Jobs *jobs, JOB_FUNC func, void *data, int jobs_count, int workers_count);
+
+#endif